@@ -0,0 +1,156 @@
+/**************************************************************************
+ * C S 429 EEL interpreter
+ *
+ * array.c - Element-wise operators and reductions on integer arrays.
+ *
+ * The arithmetic and comparison operators apply to arrays element by
+ * element, and a scalar operand is broadcast to the length of the array
+ * operand. They reuse the column kernels of batch.c, so they get the same
+ * AVX2 code paths; division and modulo run scalar, after checking every
+ * divisor so that a zero is reported as an evaluation error instead of
+ * producing a partial result. Comparisons give arrays of 0s and 1s.
+ *
+ * The reductions behind sum(), min() and max() have AVX2 versions chosen at
+ * run time in the same way as the kernels.
+ *
+ * Copyright (c) 2021. S. Chatterjee, X. Shen, T. Byrd. All rights reserved.
+ * May not be used, modified, or copied without permission.
+ **************************************************************************/
+
+#include "ci.h"
+#include <stdint.h>
+#include <pthread.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+/* fill() - set all n elements of d to v. */
+static void fill(int *d, int v, int n) {
+    for (int i = 0; i < n; i++) d[i] = v;
+}
+
+void array_binop(token_t tok, value_t *value, node_t *left, node_t *right) {
+    value->aval = NULL;
+    const array_t *a = left->type == ARRAY_TYPE ? left->val.aval : NULL;
+    const array_t *b = right->type == ARRAY_TYPE ? right->val.aval : NULL;
+    if (a && b && a->len != b->len) {
+        handle_error_at(ERR_EVAL, right->tok, right->pos);
+        return;
+    }
+    int n = a ? a->len : b->len;
+
+    if (tok == TOK_DIV || tok == TOK_MOD) {
+        bool zero = ! b && right->val.ival == 0;
+        for (int i = 0; b && i < n && ! zero; i++) zero = b->elems[i] == 0;
+        if (zero) {
+            handle_error_at(ERR_EVAL, right->tok, right->pos);
+            return;
+        }
+    }
+
+    int *d = alloc_array(value, n);
+    if (! d) return;
+    // a scalar operand is spread over the result, which then stands in for it
+    const int *x = a ? a->elems : d;
+    const int *y = b ? b->elems : d;
+    if (! a) fill(d, left->val.ival, n);
+    if (! b) fill(d, right->val.ival, n);
+
+    if (tok == TOK_DIV || tok == TOK_MOD) {
+        for (int i = 0; i < n; i++)
+            d[i] = tok == TOK_MOD ? x[i] % y[i] : x[i] / y[i];
+        return;
+    }
+    batch_kernel(tok, d, x, y, n);
+    return;
+}
+
+void array_neg(value_t *value, node_t *operand) {
+    const array_t *a = operand->val.aval;
+    int *d = alloc_array(value, a->len);
+    if (! d) return;
+    fill(d, 0, a->len);
+    batch_kernel(TOK_BMINUS, d, d, a->elems, a->len);
+    return;
+}
+
+/* Scalar reductions. Sums wrap around like the + operator. */
+
+static int r_sum(const int *a, int n) {
+    unsigned s = 0;
+    for (int i = 0; i < n; i++) s += (unsigned) a[i];
+    return (int) s;
+}
+
+static int r_min(const int *a, int n) {
+    int m = a[0];
+    for (int i = 1; i < n; i++) if (a[i] < m) m = a[i];
+    return m;
+}
+
+static int r_max(const int *a, int n) {
+    int m = a[0];
+    for (int i = 1; i < n; i++) if (a[i] > m) m = a[i];
+    return m;
+}
+
+#if defined(__x86_64__)
+
+#define AVX2 __attribute__((target("avx2")))
+#define LANES 8
+
+/* AVX2 reductions keep LANES partial results in a vector, fold them into a
+ * scalar, and finish the elements left over with the scalar version. The min
+ * and max versions need at least LANES elements. */
+#define AVX2_REDUCE(name, vop, sop)                                             \
+    AVX2 static int name##_avx2(const int *a, int n) {                          \
+        if (n < LANES) return name(a, n);                                       \
+        __m256i acc = _mm256_loadu_si256((const __m256i *) a);                  \
+        int i = LANES;                                                          \
+        for (; i + LANES <= n; i += LANES)                                      \
+            acc = vop(acc, _mm256_loadu_si256((const __m256i *) (a + i)));      \
+        int lanes[LANES];                                                       \
+        _mm256_storeu_si256((__m256i *) lanes, acc);                            \
+        int r = name(lanes, LANES);                                             \
+        if (i < n) {                                                            \
+            int rest = name(a + i, n - i);                                      \
+            r = sop;                                                            \
+        }                                                                       \
+        return r;                                                               \
+    }
+
+AVX2_REDUCE(r_sum, _mm256_add_epi32, (int) ((unsigned) r + (unsigned) rest))
+AVX2_REDUCE(r_min, _mm256_min_epi32, rest < r ? rest : r)
+AVX2_REDUCE(r_max, _mm256_max_epi32, rest > r ? rest : r)
+
+#endif
+
+typedef int (*reduce_t)(const int *, int);
+
+static reduce_t reduce_sum = r_sum, reduce_min = r_min, reduce_max = r_max;
+static pthread_once_t reducers_once = PTHREAD_ONCE_INIT;
+
+static void init_reducers(void) {
+#if defined(__x86_64__)
+    if (! __builtin_cpu_supports("avx2")) return;
+    reduce_sum = r_sum_avx2;
+    reduce_min = r_min_avx2;
+    reduce_max = r_max_avx2;
+#endif
+}
+
+int array_sum(const array_t *arr) {
+    pthread_once(&reducers_once, init_reducers);
+    return reduce_sum(arr->elems, arr->len);
+}
+
+int array_min(const array_t *arr) {
+    pthread_once(&reducers_once, init_reducers);
+    return reduce_min(arr->elems, arr->len);
+}
+
+int array_max(const array_t *arr) {
+    pthread_once(&reducers_once, init_reducers);
+    return reduce_max(arr->elems, arr->len);
+}
@@ -0,0 +1,343 @@
+/**************************************************************************
+ * C S 429 EEL interpreter
+ *
+ * batch.c - Columnar evaluation of one expression over many rows.
+ *
+ * Instead of re-running a line once per row of variable values, the
+ * expression is compiled once into a postfix program and every operator is
+ * applied to whole column vectors of BATCH_ROWS rows at a time. Each stack
+ * slot carries a value vector and an error mask vector, so division by zero
+ * marks only the affected rows and a ternary select discards the errors of
+ * the branch a row did not take.
+ *
+ * The element-wise kernels have AVX2 versions chosen at run time; integer
+ * division has no vector instruction and always runs scalar.
+ *
+ * Copyright (c) 2021. S. Chatterjee, X. Shen, T. Byrd. All rights reserved.
+ * May not be used, modified, or copied without permission.
+ **************************************************************************/
+
+#include "ci.h"
+#include <stdint.h>
+#include <pthread.h>
+
+extern bool is_unop(token_t);
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+/* push_op() - append one op to a program, growing it as needed.
+ * Return value: false if the program could not be grown. */
+static bool push_op(batch_prog_t *prog, int *cap, token_t tok, int arg) {
+    if (prog->nops == *cap) {
+        int ncap = *cap ? *cap * 2 : 32;
+        batch_op_t *nops = realloc(prog->ops, ncap * sizeof(batch_op_t));
+        if (! nops) {
+            logging(LOG_FATAL, "failed to allocate batch program");
+            return false;
+        }
+        prog->ops = nops;
+        *cap = ncap;
+    }
+    prog->ops[prog->nops].tok = tok;
+    prog->ops[prog->nops].arg = arg;
+    prog->nops++;
+    return true;
+}
+
+/* compile_node() - type-check a subtree and append its postfix ops.
+ * Return value: The type of the subtree, or NO_TYPE after reporting an
+ * error. */
+static type_t compile_node(batch_prog_t *prog, int *cap, int *depth, node_t *nptr,
+                           char **names, type_t *types, int ncols) {
+    if (! nptr) {
+        handle_error(ERR_SYNTAX);
+        return NO_TYPE;
+    }
+
+    if (nptr->node_type == NT_LEAF) {
+        type_t type = nptr->type;
+        token_t tok = TOK_NUM;
+        int arg = 0;
+        if (type == ID_TYPE) {
+            for (int i = 0; i < ncols; i++) {
+                if (strcmp(names[i], STR_VAL(nptr->val)) == 0) {
+                    tok = TOK_ID;
+                    arg = i;
+                    type = types[i];
+                    break;
+                }
+            }
+            if (tok == TOK_NUM) {
+                entry_t *var = get(STR_VAL(nptr->val));
+                if (! var) {
+                    handle_error(ERR_UNDEFINED);
+                    return NO_TYPE;
+                }
+                type = var->type;
+                arg = type == BOOL_TYPE ? var->val.bval : var->val.ival;
+            }
+        } else {
+            arg = type == BOOL_TYPE ? nptr->val.bval : nptr->val.ival;
+        }
+        if (type != INT_TYPE && type != BOOL_TYPE) {
+            handle_error(ERR_TYPE);
+            return NO_TYPE;
+        }
+        if (! push_op(prog, cap, tok, arg)) return NO_TYPE;
+        if (++(*depth) > prog->depth) prog->depth = *depth;
+        return type;
+    }
+
+    int arity = nptr->tok == TOK_QUESTION ? 3 : is_unop(nptr->tok) ? 1 : 2;
+    type_t t[3];
+    for (int i = 0; i < arity; i++) {
+        t[i] = compile_node(prog, cap, depth, nptr->children[i], names, types, ncols);
+        if (t[i] == NO_TYPE) return NO_TYPE;
+    }
+
+    type_t result;
+    switch (nptr->tok) {
+        case TOK_UMINUS:
+            result = t[0] == INT_TYPE ? INT_TYPE : NO_TYPE;
+            break;
+        case TOK_NOT:
+            result = t[0] == BOOL_TYPE ? BOOL_TYPE : NO_TYPE;
+            break;
+        case TOK_PLUS: case TOK_BMINUS: case TOK_TIMES: case TOK_DIV: case TOK_MOD:
+            result = t[0] == INT_TYPE && t[1] == INT_TYPE ? INT_TYPE : NO_TYPE;
+            break;
+        case TOK_LT: case TOK_GT: case TOK_EQ:
+            result = t[0] == INT_TYPE && t[1] == INT_TYPE ? BOOL_TYPE : NO_TYPE;
+            break;
+        case TOK_AND: case TOK_OR:
+            result = t[0] == BOOL_TYPE && t[1] == BOOL_TYPE ? BOOL_TYPE : NO_TYPE;
+            break;
+        case TOK_QUESTION:
+            result = t[0] == BOOL_TYPE && t[1] == t[2] ? t[1] : NO_TYPE;
+            break;
+        default:
+            handle_error(ERR_SYNTAX);
+            return NO_TYPE;
+    }
+    if (result == NO_TYPE) {
+        handle_error(ERR_TYPE);
+        return NO_TYPE;
+    }
+    if (! push_op(prog, cap, nptr->tok, 0)) return NO_TYPE;
+    *depth -= arity - 1;
+    return result;
+}
+
+batch_prog_t *batch_compile(node_t *expr, char **names, type_t *types, int ncols) {
+    if (terminate || ignore_input) return NULL;
+
+    batch_prog_t *prog = calloc(1, sizeof(batch_prog_t));
+    if (! prog) {
+        logging(LOG_FATAL, "failed to allocate batch program");
+        return NULL;
+    }
+    int cap = 0, depth = 0;
+    prog->type = compile_node(prog, &cap, &depth, expr, names, types, ncols);
+    if (prog->type == NO_TYPE) {
+        batch_free(prog);
+        return NULL;
+    }
+    return prog;
+}
+
+void batch_free(batch_prog_t *prog) {
+    if (! prog) return;
+    free(prog->ops);
+    free(prog);
+}
+
+/* Scalar kernels. Each applies one operator to n lanes: d = a op b. */
+
+static void k_add(int32_t *d, const int32_t *a, const int32_t *b, int n) {
+    for (int i = 0; i < n; i++) d[i] = (int32_t) ((uint32_t) a[i] + (uint32_t) b[i]);
+}
+
+static void k_sub(int32_t *d, const int32_t *a, const int32_t *b, int n) {
+    for (int i = 0; i < n; i++) d[i] = (int32_t) ((uint32_t) a[i] - (uint32_t) b[i]);
+}
+
+static void k_mul(int32_t *d, const int32_t *a, const int32_t *b, int n) {
+    for (int i = 0; i < n; i++) d[i] = (int32_t) ((uint32_t) a[i] * (uint32_t) b[i]);
+}
+
+static void k_and(int32_t *d, const int32_t *a, const int32_t *b, int n) {
+    for (int i = 0; i < n; i++) d[i] = a[i] & b[i];
+}
+
+static void k_or(int32_t *d, const int32_t *a, const int32_t *b, int n) {
+    for (int i = 0; i < n; i++) d[i] = a[i] | b[i];
+}
+
+static void k_lt(int32_t *d, const int32_t *a, const int32_t *b, int n) {
+    for (int i = 0; i < n; i++) d[i] = a[i] < b[i];
+}
+
+static void k_gt(int32_t *d, const int32_t *a, const int32_t *b, int n) {
+    for (int i = 0; i < n; i++) d[i] = a[i] > b[i];
+}
+
+static void k_eq(int32_t *d, const int32_t *a, const int32_t *b, int n) {
+    for (int i = 0; i < n; i++) d[i] = a[i] == b[i];
+}
+
+/* d = c ? a : b, lane by lane. */
+static void k_select(int32_t *d, const int32_t *c, const int32_t *a, const int32_t *b, int n) {
+    for (int i = 0; i < n; i++) d[i] = c[i] ? a[i] : b[i];
+}
+
+#if defined(__x86_64__)
+
+#define AVX2 __attribute__((target("avx2")))
+#define LANES 8
+
+#define AVX2_KERNEL(name, expr)                                                 \
+    AVX2 static void name##_avx2(int32_t *d, const int32_t *a,                  \
+                                 const int32_t *b, int n) {                     \
+        int i = 0;                                                              \
+        for (; i + LANES <= n; i += LANES) {                                    \
+            __m256i x = _mm256_loadu_si256((const __m256i *) (a + i));          \
+            __m256i y = _mm256_loadu_si256((const __m256i *) (b + i));          \
+            _mm256_storeu_si256((__m256i *) (d + i), (expr));                   \
+        }                                                                       \
+        name(d + i, a + i, b + i, n - i);                                       \
+    }
+
+AVX2_KERNEL(k_add, _mm256_add_epi32(x, y))
+AVX2_KERNEL(k_sub, _mm256_sub_epi32(x, y))
+AVX2_KERNEL(k_mul, _mm256_mullo_epi32(x, y))
+AVX2_KERNEL(k_and, _mm256_and_si256(x, y))
+AVX2_KERNEL(k_or, _mm256_or_si256(x, y))
+AVX2_KERNEL(k_lt, _mm256_and_si256(_mm256_cmpgt_epi32(y, x), _mm256_set1_epi32(1)))
+AVX2_KERNEL(k_gt, _mm256_and_si256(_mm256_cmpgt_epi32(x, y), _mm256_set1_epi32(1)))
+AVX2_KERNEL(k_eq, _mm256_and_si256(_mm256_cmpeq_epi32(x, y), _mm256_set1_epi32(1)))
+
+AVX2 static void k_select_avx2(int32_t *d, const int32_t *c, const int32_t *a,
+                               const int32_t *b, int n) {
+    int i = 0;
+    __m256i zero = _mm256_setzero_si256();
+    for (; i + LANES <= n; i += LANES) {
+        __m256i m = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *) (c + i)), zero);
+        __m256i x = _mm256_loadu_si256((const __m256i *) (a + i));
+        __m256i y = _mm256_loadu_si256((const __m256i *) (b + i));
+        _mm256_storeu_si256((__m256i *) (d + i), _mm256_blendv_epi8(x, y, m));
+    }
+    k_select(d + i, c + i, a + i, b + i, n - i);
+}
+
+#endif
+
+typedef void (*kernel_t)(int32_t *, const int32_t *, const int32_t *, int);
+typedef void (*select_t)(int32_t *, const int32_t *, const int32_t *, const int32_t *, int);
+
+/* Kernel table indexed by token - TOK_PLUS; division has no kernel. */
+static kernel_t binop_kernels[TOK_EQ - TOK_PLUS + 1] = {
+    k_add, k_sub, k_mul, NULL, NULL, k_and, k_or, k_lt, k_gt, k_eq
+};
+static select_t select_kernel = k_select;
+// worker threads of --jobs may be the first to need the kernels
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+static void init_kernels(void) {
+#if defined(__x86_64__)
+    if (! __builtin_cpu_supports("avx2")) return;
+    kernel_t avx2[] = {
+        k_add_avx2, k_sub_avx2, k_mul_avx2, NULL, NULL,
+        k_and_avx2, k_or_avx2, k_lt_avx2, k_gt_avx2, k_eq_avx2
+    };
+    memcpy(binop_kernels, avx2, sizeof(avx2));
+    select_kernel = k_select_avx2;
+#endif
+}
+
+/* Division and modulo: rows with a zero divisor get 0 and an error. */
+static void k_divmod(bool mod, int32_t *d, int32_t *e, const int32_t *a, const int32_t *b, int n) {
+    for (int i = 0; i < n; i++) {
+        if (b[i] == 0) {
+            d[i] = 0;
+            e[i] = 1;
+        } else {
+            d[i] = mod ? a[i] % b[i] : a[i] / b[i];
+        }
+    }
+}
+
+void batch_kernel(token_t tok, int32_t *d, const int32_t *a, const int32_t *b, int n) {
+    pthread_once(&kernels_once, init_kernels);
+    binop_kernels[tok - TOK_PLUS](d, a, b, n);
+}
+
+void batch_run(batch_prog_t *prog, int32_t **cols, int nrows, int32_t *out, int32_t *err) {
+    pthread_once(&kernels_once, init_kernels);
+
+    /* each stack slot holds a value vector followed by an error vector */
+    int32_t *stack = malloc((size_t) prog->depth * 2 * BATCH_ROWS * sizeof(int32_t));
+    int32_t *zeros = calloc(BATCH_ROWS, sizeof(int32_t));
+    if (! stack || ! zeros) {
+        free(stack);
+        free(zeros);
+        logging(LOG_FATAL, "failed to allocate batch stack");
+        return;
+    }
+
+    for (int base = 0; base < nrows; base += BATCH_ROWS) {
+        int n = nrows - base < BATCH_ROWS ? nrows - base : BATCH_ROWS;
+        int sp = 0;
+        for (int k = 0; k < prog->nops; k++) {
+            batch_op_t *op = &prog->ops[k];
+            #define VAL(s) (stack + (size_t) (s) * 2 * BATCH_ROWS)
+            #define ERR(s) (VAL(s) + BATCH_ROWS)
+            switch (op->tok) {
+                case TOK_ID:
+                    memcpy(VAL(sp), cols[op->arg] + base, n * sizeof(int32_t));
+                    memset(ERR(sp), 0, n * sizeof(int32_t));
+                    sp++;
+                    break;
+                case TOK_NUM:
+                    for (int i = 0; i < n; i++) VAL(sp)[i] = op->arg;
+                    memset(ERR(sp), 0, n * sizeof(int32_t));
+                    sp++;
+                    break;
+                case TOK_UMINUS:
+                    /* -x is 0 - x, !x is x ~ 0 */
+                    binop_kernels[TOK_BMINUS - TOK_PLUS](VAL(sp - 1), zeros, VAL(sp - 1), n);
+                    break;
+                case TOK_NOT:
+                    binop_kernels[TOK_EQ - TOK_PLUS](VAL(sp - 1), VAL(sp - 1), zeros, n);
+                    break;
+                case TOK_QUESTION:
+                    select_kernel(ERR(sp - 2), VAL(sp - 3), ERR(sp - 2), ERR(sp - 1), n);
+                    select_kernel(VAL(sp - 3), VAL(sp - 3), VAL(sp - 2), VAL(sp - 1), n);
+                    binop_kernels[TOK_OR - TOK_PLUS](ERR(sp - 3), ERR(sp - 3), ERR(sp - 2), n);
+                    sp -= 2;
+                    break;
+                case TOK_DIV:
+                case TOK_MOD:
+                    binop_kernels[TOK_OR - TOK_PLUS](ERR(sp - 2), ERR(sp - 2), ERR(sp - 1), n);
+                    k_divmod(op->tok == TOK_MOD, VAL(sp - 2), ERR(sp - 2), VAL(sp - 2), VAL(sp - 1), n);
+                    sp--;
+                    break;
+                default:
+                    binop_kernels[op->tok - TOK_PLUS](VAL(sp - 2), VAL(sp - 2), VAL(sp - 1), n);
+                    binop_kernels[TOK_OR - TOK_PLUS](ERR(sp - 2), ERR(sp - 2), ERR(sp - 1), n);
+                    sp--;
+                    break;
+            }
+        }
+        memcpy(out + base, VAL(0), n * sizeof(int32_t));
+        memcpy(err + base, ERR(0), n * sizeof(int32_t));
+        /* rows in error report 0 rather than a partial result */
+        for (int i = 0; i < n; i++)
+            if (err[base + i]) out[base + i] = 0;
+        #undef VAL
+        #undef ERR
+    }
+    free(stack);
+    free(zeros);
+}
@@ -0,0 +1,46 @@
+/**************************************************************************
+ * C S 429 EEL interpreter
+ *
+ * batch.h - Columnar evaluation of one expression over many rows of
+ * variable bindings.
+ *
+ * Copyright (c) 2021. S. Chatterjee, X. Shen, T. Byrd. All rights reserved.
+ * May not be used, modified, or copied without permission.
+ **************************************************************************/
+
+/* Rows processed by one pass of the vector kernels. */
+#define BATCH_ROWS 1024
+
+/* One step of a compiled batch program. Programs are in postfix order and
+ * run on a stack of column vectors. */
+typedef struct batch_op {
+    token_t tok;        // TOK_ID: push column arg; TOK_NUM: push constant arg;
+                        // otherwise the operator to apply
+    int arg;
+} batch_op_t;
+
+/* An int/bool expression compiled against a set of named input columns.
+ * Ints and bools are both stored as int32_t lanes, bools as 0 or 1. */
+typedef struct batch_prog {
+    batch_op_t *ops;
+    int nops;
+    int depth;          // stack slots needed to run the program
+    type_t type;        // INT_TYPE or BOOL_TYPE
+} batch_prog_t;
+
+/* Type-check an expression tree against named columns of the given types and
+ * compile it. Identifiers that are not columns are read from var_table as
+ * constants. Errors are reported through handle_error and return NULL. */
+extern batch_prog_t *batch_compile(node_t *expr, char **names, type_t *types, int ncols);
+
+/* Evaluate a program over nrows rows of the input columns. out receives the
+ * result of each row and err is set to 1 for rows that divided by zero (their
+ * out value is 0) and to 0 for the rest. Ternaries act as a select, so an
+ * error in the branch a row did not take does not mark that row. */
+extern void batch_run(batch_prog_t *prog, int32_t **cols, int nrows, int32_t *out, int32_t *err);
+
+extern void batch_free(batch_prog_t *prog);
+
+/* Apply one element-wise operator other than / and % to n lanes, d = a op b,
+ * with the fastest kernel available. d may be the same as a or b. */
+extern void batch_kernel(token_t tok, int32_t *d, const int32_t *a, const int32_t *b, int n);
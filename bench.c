@@ -0,0 +1,69 @@
+/**************************************************************************
+ * C S 429 EEL interpreter
+ *
+ * bench.c - In-process timing of expressions (@bench N expr).
+ *
+ * The expression is parsed and its types inferred once against the current
+ * variables, then evaluated N times. Nothing is printed for the evaluations
+ * and an assignment only evaluates its right-hand side, so the command has no
+ * effect on the variables. The time of each evaluation is taken with the
+ * monotonic clock, and the minimum, median and 99th percentile are reported
+ * along with the number of heap strings allocated per evaluation.
+ *
+ * Copyright (c) 2021. S. Chatterjee, X. Shen, T. Byrd. All rights reserved.
+ * May not be used, modified, or copied without permission.
+ **************************************************************************/
+
+#include "ci.h"
+#include <time.h>
+
+extern node_t *parse_text(const char *line);
+
+static int compare_ns(const void *a, const void *b) {
+    long x = *(const long *) a, y = *(const long *) b;
+    return (x > y) - (x < y);
+}
+
+void run_bench(long runs, char *expr) {
+    char line[MAX_LINE_CHARS];
+    snprintf(line, sizeof(line), "%s\n", expr);
+    node_t *root = parse_text(line);
+    if (root && ! ignore_input && root->type == ID_TYPE) {
+        /* time the right-hand side only, so no variable is assigned */
+        cleanup(root->children[0]);
+        root->children[0] = root->children[1];
+        root->children[1] = NULL;
+        root->type = NO_TYPE;
+    }
+    infer_expr(root);
+
+    long *ns = NULL;
+    if (root && ! ignore_input && ! terminate
+        && ! (ns = (long *) malloc(runs * sizeof(long)))) {
+        logging(LOG_ERROR, "failed to allocate @bench timings");
+    }
+
+    long n;
+    unsigned long allocs = str_allocs;
+    for (n = 0; ns && n < runs && ! ignore_input && ! terminate; n++) {
+        struct timespec start, end;
+        if (n > 0) reset_eval(root);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        eval_root(root);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        ns[n] = (end.tv_sec - start.tv_sec) * 1000000000L + (end.tv_nsec - start.tv_nsec);
+    }
+    allocs = str_allocs - allocs;
+
+    /* an evaluation error has been reported and ends the run */
+    if (ns && ! ignore_input && ! terminate) {
+        qsort(ns, runs, sizeof(long), compare_ns);
+        long p99 = runs * 99 / 100;
+        fprintf(outfile, "\tbench: %ld runs, min %ld ns, median %ld ns, p99 %ld ns, %.1f allocs/run\n",
+                runs, ns[0], ns[runs / 2], ns[p99 < runs ? p99 : runs - 1],
+                (double) allocs / runs);
+    }
+    free(ns);
+    cleanup(root);
+    return;
+}
@@ -0,0 +1,274 @@
+/**************************************************************************
+ * C S 429 EEL interpreter
+ *
+ * builtin.c - Built-in string and array functions, called as name(arg, ...).
+ *
+ * A call is parsed into a TOK_CALL node whose op field holds the index + 1
+ * of the function in builtins[], with the arguments as its children. A name
+ * may have several entries with the same number of arguments, and type
+ * inference picks the one that matches the argument types.
+ * Substring search filters candidate positions 16 at a time by comparing
+ * both the first and the last byte of the needle, and only compares the
+ * candidates in full; case mapping converts 16 bytes at a time. The vector
+ * code uses SSE2, which every x86-64 CPU has, and other machines run the
+ * scalar loops that also finish each string.
+ *
+ * Copyright (c) 2021. S. Chatterjee, X. Shen, T. Byrd. All rights reserved.
+ * May not be used, modified, or copied without permission.
+ **************************************************************************/
+
+#include "ci.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+typedef void (*builtin_fn_t)(value_t *value, node_t *call);
+
+static void fn_len(value_t *value, node_t *call);
+static void fn_find(value_t *value, node_t *call);
+static void fn_contains(value_t *value, node_t *call);
+static void fn_count(value_t *value, node_t *call);
+static void fn_substr(value_t *value, node_t *call);
+static void fn_upper(value_t *value, node_t *call);
+static void fn_lower(value_t *value, node_t *call);
+static void fn_replace(value_t *value, node_t *call);
+static void fn_array_len(value_t *value, node_t *call);
+static void fn_range(value_t *value, node_t *call);
+static void fn_sum(value_t *value, node_t *call);
+static void fn_min(value_t *value, node_t *call);
+static void fn_max(value_t *value, node_t *call);
+
+static const struct {
+    const char *name;
+    int nargs;
+    type_t args[3];         // argument types
+    type_t result;          // type of the result
+    builtin_fn_t func;
+} builtins[] = {
+    {"len",      1, {STRING_TYPE},                            INT_TYPE,    &fn_len},
+    {"find",     2, {STRING_TYPE, STRING_TYPE},               INT_TYPE,    &fn_find},
+    {"contains", 2, {STRING_TYPE, STRING_TYPE},               BOOL_TYPE,   &fn_contains},
+    {"count",    2, {STRING_TYPE, STRING_TYPE},               INT_TYPE,    &fn_count},
+    {"substr",   3, {STRING_TYPE, INT_TYPE, INT_TYPE},        STRING_TYPE, &fn_substr},
+    {"upper",    1, {STRING_TYPE},                            STRING_TYPE, &fn_upper},
+    {"lower",    1, {STRING_TYPE},                            STRING_TYPE, &fn_lower},
+    {"replace",  3, {STRING_TYPE, STRING_TYPE, STRING_TYPE},  STRING_TYPE, &fn_replace},
+    {"len",      1, {ARRAY_TYPE},                             INT_TYPE,    &fn_array_len},
+    {"range",    2, {INT_TYPE, INT_TYPE},                     ARRAY_TYPE,  &fn_range},
+    {"sum",      1, {ARRAY_TYPE},                             INT_TYPE,    &fn_sum},
+    {"min",      1, {ARRAY_TYPE},                             INT_TYPE,    &fn_min},
+    {"max",      1, {ARRAY_TYPE},                             INT_TYPE,    &fn_max}
+};
+
+/* Longest array range() may build. */
+#define RANGE_MAX (1 << 24)
+
+#define NUM_BUILTINS ((int) (sizeof(builtins) / sizeof(builtins[0])))
+#define ARG(call, i) STR_VAL((call)->children[i]->val)
+#define ARG_LEN(call, i) str_len(&(call)->children[i]->val)
+
+int find_builtin(const char *name) {
+    for (int i = 0; i < NUM_BUILTINS; i++)
+        if (strcmp(builtins[i].name, name) == 0) return i;
+    return -1;
+}
+
+int builtin_arity(int fn) {
+    return builtins[fn].nargs;
+}
+
+const char *builtin_name(int fn) {
+    return builtins[fn].name;
+}
+
+bool builtin_type(node_t *call) {
+    const char *name = builtins[call->op - 1].name;
+    for (int fn = 0; fn < NUM_BUILTINS; fn++) {
+        if (strcmp(builtins[fn].name, name) != 0) continue;
+        int i = 0;
+        while (i < builtins[fn].nargs && call->children[i]
+               && call->children[i]->type == builtins[fn].args[i])
+            i++;
+        if (i == builtins[fn].nargs) {
+            call->op = fn + 1;
+            call->type = builtins[fn].result;
+            return true;
+        }
+    }
+    return false;
+}
+
+void call_builtin(node_t *call) {
+    (*builtins[call->op - 1].func)(&call->val, call);
+}
+
+/* find_bytes() - find the first occurrence of needle in hay.
+ * Return value: Its position, or -1 if there is none. */
+static long find_bytes(const char *hay, size_t hlen, const char *needle, size_t nlen) {
+    if (nlen == 0) return 0;
+    if (nlen > hlen) return -1;
+    size_t i = 0, starts = hlen - nlen + 1;
+#if defined(__x86_64__)
+    __m128i first = _mm_set1_epi8(needle[0]);
+    __m128i last = _mm_set1_epi8(needle[nlen - 1]);
+    for (; i + 16 <= starts; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *) (hay + i));
+        __m128i b = _mm_loadu_si128((const __m128i *) (hay + i + nlen - 1));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first),
+                                                        _mm_cmpeq_epi8(b, last)));
+        for (; mask; mask &= mask - 1) {
+            size_t pos = i + __builtin_ctz(mask);
+            if (nlen <= 2 || memcmp(hay + pos + 1, needle + 1, nlen - 2) == 0) return pos;
+        }
+    }
+#endif
+    for (; i < starts; i++)
+        if (hay[i] == needle[0] && memcmp(hay + i, needle, nlen) == 0) return i;
+    return -1;
+}
+
+/* map_case() - copy len characters, converting letters to upper or lower
+ * case. Bytes outside ASCII are copied unchanged. */
+static void map_case(char *dst, const char *src, size_t len, bool upper) {
+    char from = upper ? 'a' : 'A';
+    size_t i = 0;
+#if defined(__x86_64__)
+    __m128i below = _mm_set1_epi8(from - 1), above = _mm_set1_epi8(from + 26);
+    __m128i flip = _mm_set1_epi8(0x20);
+    for (; i + 16 <= len; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *) (src + i));
+        __m128i letters = _mm_and_si128(_mm_cmpgt_epi8(x, below), _mm_cmplt_epi8(x, above));
+        _mm_storeu_si128((__m128i *) (dst + i), _mm_xor_si128(x, _mm_and_si128(letters, flip)));
+    }
+#endif
+    for (; i < len; i++)
+        dst[i] = src[i] >= from && src[i] < from + 26 ? src[i] ^ 0x20 : src[i];
+}
+
+/* len(s) - the number of characters in s. */
+static void fn_len(value_t *value, node_t *call) {
+    value->ival = (int) ARG_LEN(call, 0);
+}
+
+/* find(s, t) - the position of the first t in s, or -1. */
+static void fn_find(value_t *value, node_t *call) {
+    value->ival = (int) find_bytes(ARG(call, 0), ARG_LEN(call, 0), ARG(call, 1), ARG_LEN(call, 1));
+}
+
+/* contains(s, t) - whether t occurs in s. */
+static void fn_contains(value_t *value, node_t *call) {
+    value->bval = find_bytes(ARG(call, 0), ARG_LEN(call, 0), ARG(call, 1), ARG_LEN(call, 1)) >= 0;
+}
+
+/* count_bytes() - the number of non-overlapping occurrences of needle in hay.
+ * An empty needle occurs before every character and at the end. */
+static size_t count_bytes(const char *hay, size_t hlen, const char *needle, size_t nlen) {
+    if (nlen == 0) return hlen + 1;
+    size_t count = 0;
+    long pos;
+    while ((pos = find_bytes(hay, hlen, needle, nlen)) >= 0) {
+        count++;
+        hay += pos + nlen;
+        hlen -= pos + nlen;
+    }
+    return count;
+}
+
+/* count(s, t) - the number of non-overlapping occurrences of t in s. */
+static void fn_count(value_t *value, node_t *call) {
+    value->ival = (int) count_bytes(ARG(call, 0), ARG_LEN(call, 0), ARG(call, 1), ARG_LEN(call, 1));
+}
+
+/* substr(s, start, n) - at most n characters of s from position start.
+ * Causes an evaluation error if start or n is negative. */
+static void fn_substr(value_t *value, node_t *call) {
+    int start = call->children[1]->val.ival, n = call->children[2]->val.ival;
+    if (start < 0 || n < 0) {
+        handle_error_at(ERR_EVAL, call->tok, call->pos);
+        return;
+    }
+    size_t len = ARG_LEN(call, 0);
+    if ((size_t) start > len) start = len;
+    if ((size_t) n > len - start) n = len - start;
+    char *buf = alloc_str(value, n);
+    if (! buf) return;
+    memcpy(buf, ARG(call, 0) + start, n);
+}
+
+/* upper(s), lower(s) - s with its letters converted to one case. */
+static void fn_upper(value_t *value, node_t *call) {
+    size_t len = ARG_LEN(call, 0);
+    char *buf = alloc_str(value, len);
+    if (buf) map_case(buf, ARG(call, 0), len, true);
+}
+
+static void fn_lower(value_t *value, node_t *call) {
+    size_t len = ARG_LEN(call, 0);
+    char *buf = alloc_str(value, len);
+    if (buf) map_case(buf, ARG(call, 0), len, false);
+}
+
+/* replace(s, old, new) - s with every non-overlapping old replaced by new.
+ * An empty old leaves s unchanged. */
+static void fn_replace(value_t *value, node_t *call) {
+    const char *s = ARG(call, 0), *old = ARG(call, 1), *new = ARG(call, 2);
+    size_t slen = ARG_LEN(call, 0), olen = ARG_LEN(call, 1), nlen = ARG_LEN(call, 2);
+    size_t count = olen ? count_bytes(s, slen, old, olen) : 0;
+    char *buf = alloc_str(value, slen - count * olen + count * nlen);
+    if (! buf) return;
+
+    long pos;
+    while (count-- > 0 && (pos = find_bytes(s, slen, old, olen)) >= 0) {
+        memcpy(buf, s, pos);
+        memcpy(buf + pos, new, nlen);
+        buf += pos + nlen;
+        s += pos + olen;
+        slen -= pos + olen;
+    }
+    memcpy(buf, s, slen);
+}
+
+/* len(a) - the number of elements of a. */
+static void fn_array_len(value_t *value, node_t *call) {
+    value->ival = call->children[0]->val.aval->len;
+}
+
+/* range(lo, hi) - the array [lo, lo + 1, ..., hi - 1], empty if hi <= lo.
+ * Causes an evaluation error if it would be longer than RANGE_MAX. */
+static void fn_range(value_t *value, node_t *call) {
+    value->aval = NULL;
+    long lo = call->children[0]->val.ival, hi = call->children[1]->val.ival;
+    long n = hi > lo ? hi - lo : 0;
+    if (n > RANGE_MAX) {
+        handle_error_at(ERR_EVAL, call->tok, call->pos);
+        return;
+    }
+    int *elems = alloc_array(value, (int) n);
+    if (! elems) return;
+    for (long i = 0; i < n; i++) elems[i] = (int) (lo + i);
+}
+
+/* sum(a), min(a), max(a) - reductions over the elements of a. The sum of an
+ * empty array is 0; min and max cause an evaluation error on one. */
+static void fn_sum(value_t *value, node_t *call) {
+    value->ival = array_sum(call->children[0]->val.aval);
+}
+
+static void fn_min(value_t *value, node_t *call) {
+    const array_t *arr = call->children[0]->val.aval;
+    if (arr->len == 0) {
+        handle_error_at(ERR_EVAL, call->tok, call->pos);
+        return;
+    }
+    value->ival = array_min(arr);
+}
+
+static void fn_max(value_t *value, node_t *call) {
+    const array_t *arr = call->children[0]->val.aval;
+    if (arr->len == 0) {
+        handle_error_at(ERR_EVAL, call->tok, call->pos);
+        return;
+    }
+    value->ival = array_max(arr);
+}
@@ -0,0 +1,354 @@
+/**************************************************************************
+ * C S 429 EEL interpreter
+ *
+ * cache.c - Persistent on-disk cache of parsed scripts (-c dir).
+ *
+ * When an input file is given with -i, its contents are hashed and the
+ * cache directory is searched for an image with that hash. On a hit, every
+ * line is replayed from the image: lines that parsed cleanly come back as
+ * ready-made ASTs and skip the lexer and parser entirely, while commands and
+ * lines with lexical or syntax errors are stored as raw text and go through
+ * the normal path so their side effects and error messages are unchanged.
+ * On a miss, the image is recorded while the script runs and written when
+ * it ends. Type inference is not cached, since the types of variable
+ * references depend on the bindings of each run.
+ *
+ * Copyright (c) 2021. S. Chatterjee, X. Shen, T. Byrd. All rights reserved.
+ * May not be used, modified, or copied without permission.
+ **************************************************************************/
+
+#include "ci.h"
+#include <stdint.h>
+
+extern void set_input_line(const char *line);
+extern const char *lexer_line(void);
+
+static const char CACHE_MAGIC[8] = "EELCACHE";
+static const uint32_t CACHE_VERSION = 4;
+
+/* Kinds of line records in an image. */
+typedef enum {
+    REC_TREE,       // a serialized AST
+    REC_RAW         // the input line, to be lexed and parsed again
+} rec_kind_t;
+
+/* Image header. The checksum covers everything after the header. */
+typedef struct cache_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t node_size;     // sizeof(node_t), guards against layout changes
+    uint64_t key;           // hash of the input file contents
+    uint64_t checksum;      // hash of the record area
+    uint64_t size;          // size of the record area in bytes
+} cache_header_t;
+
+typedef enum {
+    CACHE_OFF,
+    CACHE_RECORD,
+    CACHE_REPLAY
+} cache_mode_t;
+
+static cache_mode_t mode = CACHE_OFF;
+static char *cache_path = NULL;
+static uint64_t cache_key;
+
+/* Record area being written (CACHE_RECORD) or replayed (CACHE_REPLAY). */
+static unsigned char *buf = NULL;
+static size_t buf_len = 0, buf_cap = 0, buf_pos = 0;
+static size_t lines_replayed = 0;
+static bool saw_quit = false;
+static char printbuf[100];
+
+/* 64-bit FNV-1a hash. */
+static uint64_t fnv1a(const unsigned char *p, size_t n) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < n; i++) {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+/* Abandon the cache for this run, e.g. after an allocation failure. */
+static void cache_off(void) {
+    mode = CACHE_OFF;
+    free(buf);
+    buf = NULL;
+    buf_len = buf_cap = buf_pos = 0;
+}
+
+static bool emit(const void *p, size_t n) {
+    if (buf_len + n > buf_cap) {
+        size_t ncap = buf_cap ? buf_cap * 2 : 4096;
+        while (ncap < buf_len + n) ncap *= 2;
+        unsigned char *nbuf = realloc(buf, ncap);
+        if (! nbuf) return false;
+        buf = nbuf;
+        buf_cap = ncap;
+    }
+    memcpy(buf + buf_len, p, n);
+    buf_len += n;
+    return true;
+}
+
+static bool emit_u8(int v) {
+    unsigned char c = (unsigned char) v;
+    return emit(&c, 1);
+}
+
+static bool emit_str(const char *s) {
+    uint16_t len = (uint16_t) strlen(s);
+    return emit(&len, sizeof(len)) && emit(s, len);
+}
+
+/* Serialize a parsed (not yet inferred) tree in preorder. */
+static bool emit_tree(node_t *nptr) {
+    if (! nptr) return emit_u8(0);
+    if (! emit_u8(1) || ! emit_u8(nptr->tok) || ! emit_u8(nptr->node_type)
+        || ! emit_u8(nptr->type) || ! emit_u8(nptr->pos) || ! emit_u8(nptr->op))
+        return false;
+    if (nptr->node_type == NT_LEAF) {
+        if (nptr->type == STRING_TYPE || nptr->type == ID_TYPE) {
+            if (! emit_str(STR_VAL(nptr->val))) return false;
+        } else if (nptr->type == ARRAY_TYPE) {
+            const array_t *arr = nptr->val.aval;
+            if (! emit(arr, sizeof(arr->len) + arr->len * sizeof(int))) return false;
+        } else {
+            int32_t v = nptr->type == BOOL_TYPE ? nptr->val.bval
+                      : nptr->type == FMT_TYPE ? nptr->val.fval : nptr->val.ival;
+            if (! emit(&v, sizeof(v))) return false;
+        }
+    }
+    for (int i = 0; i < 3; i++)
+        if (! emit_tree(nptr->children[i])) return false;
+    return true;
+}
+
+static bool take(void *p, size_t n) {
+    if (buf_pos + n > buf_len) return false;
+    memcpy(p, buf + buf_pos, n);
+    buf_pos += n;
+    return true;
+}
+
+static int take_u8(void) {
+    unsigned char c;
+    return take(&c, 1) ? (signed char) c : -128;
+}
+
+static bool take_array(value_t *value) {
+    int len;
+    if (! take(&len, sizeof(len)) || len < 0
+        || buf_pos + (size_t) len * sizeof(int) > buf_len)
+        return false;
+    int *elems = alloc_array(value, len);
+    return elems && take(elems, len * sizeof(int));
+}
+
+static bool take_str(value_t *value) {
+    uint16_t len;
+    if (! take(&len, sizeof(len)) || buf_pos + len > buf_len) return false;
+    char *s = alloc_str(value, len);
+    if (! s) return false;
+    memcpy(s, buf + buf_pos, len);
+    buf_pos += len;
+    return true;
+}
+
+/* Rebuild a tree written by emit_tree(). The image was checksummed when it
+ * was opened, so a failure here means the image is truncated or was
+ * written by an incompatible build. */
+static bool take_tree(node_t **out) {
+    *out = NULL;
+    int present = take_u8();
+    if (present == 0) return true;
+    if (present != 1) return false;
+
+    node_t *nptr = calloc(1, sizeof(node_t));
+    if (! nptr) return false;
+    nptr->tok = take_u8();
+    nptr->node_type = take_u8();
+    nptr->type = take_u8();
+    nptr->pos = (unsigned char) take_u8();
+    nptr->op = (unsigned char) take_u8();
+    *out = nptr;
+    if (nptr->node_type == NT_LEAF) {
+        if (nptr->type == STRING_TYPE || nptr->type == ID_TYPE) {
+            if (! take_str(&nptr->val)) {
+                nptr->type = NO_TYPE;
+                return false;
+            }
+        } else if (nptr->type == ARRAY_TYPE) {
+            if (! take_array(&nptr->val)) {
+                nptr->type = NO_TYPE;
+                return false;
+            }
+        } else {
+            int32_t v;
+            if (! take(&v, sizeof(v))) return false;
+            if (nptr->type == BOOL_TYPE) nptr->val.bval = v != 0;
+            else if (nptr->type == FMT_TYPE) nptr->val.fval = (char) v;
+            else nptr->val.ival = v;
+        }
+    }
+    for (int i = 0; i < 3; i++)
+        if (! take_tree(&nptr->children[i])) return false;
+    return true;
+}
+
+/* Try to open the image for the current key. Any mismatch in the header,
+ * size or checksum is treated as a miss. */
+static bool load_image(void) {
+    FILE *fp = fopen(cache_path, "rb");
+    if (! fp) return false;
+
+    cache_header_t header;
+    bool ok = fread(&header, sizeof(header), 1, fp) == 1
+           && memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) == 0
+           && header.version == CACHE_VERSION
+           && header.node_size == sizeof(node_t)
+           && header.key == cache_key
+           && header.size > 0 && header.size < (1UL << 32);
+    if (ok) {
+        buf = malloc(header.size);
+        ok = buf && fread(buf, 1, header.size, fp) == header.size
+             && fgetc(fp) == EOF
+             && fnv1a(buf, header.size) == header.checksum;
+    }
+    fclose(fp);
+    if (! ok) {
+        free(buf);
+        buf = NULL;
+        return false;
+    }
+    buf_len = header.size;
+    buf_cap = header.size;
+    buf_pos = 0;
+    return true;
+}
+
+void cache_open(char *dir, FILE *in) {
+    if (! dir || ! in || in == stdin) return;
+
+    /* hash the whole input, then rewind it for normal reading */
+    size_t cap = 4096, len = 0, n;
+    unsigned char *data = malloc(cap);
+    while (data && (n = fread(data + len, 1, cap - len, in)) > 0) {
+        len += n;
+        if (len == cap) {
+            unsigned char *ndata = realloc(data, cap *= 2);
+            if (! ndata) free(data);
+            data = ndata;
+        }
+    }
+    if (! data) {
+        logging(LOG_INFO, "failed to hash input; script cache disabled");
+        rewind(in);
+        return;
+    }
+    cache_key = fnv1a(data, len);
+    free(data);
+
+    cache_path = malloc(strlen(dir) + 32);
+    if (! cache_path) {
+        rewind(in);
+        return;
+    }
+    sprintf(cache_path, "%s/%016llx.eelc", dir, (unsigned long long) cache_key);
+
+    if (load_image()) {
+        /* the input is never read on a hit; it is left at end of file so
+         * running out of records behaves like running out of input */
+        mode = CACHE_REPLAY;
+        return;
+    }
+    rewind(in);
+    mode = CACHE_RECORD;
+    return;
+}
+
+/* Stop replaying and continue from the matching line of the input file. */
+static void replay_fallback(void) {
+    char line[MAX_LINE_CHARS];
+    logging(LOG_INFO, "corrupt script cache image ignored");
+    cache_off();
+    rewind(infile);
+    for (size_t i = 0; i < lines_replayed; i++)
+        if (! fgets(line, sizeof(line), infile)) break;
+}
+
+bool cache_replay(node_t **root) {
+    if (mode != CACHE_REPLAY || buf_pos >= buf_len) return false;
+
+    int kind = take_u8();
+    if (kind == REC_TREE) {
+        if (take_tree(root)) {
+            lines_replayed++;
+            return true;
+        }
+        cleanup(*root);
+        *root = NULL;
+    } else if (kind == REC_RAW) {
+        value_t line = {0};
+        if (take_str(&line)) {
+            set_input_line(STR_VAL(line));
+            free_str(&line);
+            lines_replayed++;
+            return false;
+        }
+    }
+    replay_fallback();
+    return false;
+}
+
+void cache_record(node_t *root) {
+    if (mode != CACHE_RECORD) return;
+
+    const char *line = lexer_line();
+    if (! line) {
+        /* overlong or unterminated lines cannot be replayed faithfully */
+        if (! terminate) cache_off();
+        return;
+    }
+    bool ok;
+    if (terminate || ignore_input || ! root) {
+        saw_quit = terminate;
+        ok = emit_u8(REC_RAW) && emit_str(line);
+    } else {
+        size_t mark = buf_len;
+        ok = emit_u8(REC_TREE) && emit_tree(root);
+        if (! ok) buf_len = mark;
+    }
+    if (! ok) cache_off();
+}
+
+void cache_close(void) {
+    if (mode == CACHE_RECORD && buf_len > 0 && (saw_quit || feof(infile))) {
+        cache_header_t header;
+        memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+        header.version = CACHE_VERSION;
+        header.node_size = sizeof(node_t);
+        header.key = cache_key;
+        header.checksum = fnv1a(buf, buf_len);
+        header.size = buf_len;
+
+        /* write to a private name first so readers never see a partial image */
+        char *tmp = malloc(strlen(cache_path) + 16);
+        if (tmp) {
+            sprintf(tmp, "%s.%d", cache_path, (int) getpid());
+            FILE *fp = fopen(tmp, "wb");
+            bool ok = fp && fwrite(&header, sizeof(header), 1, fp) == 1
+                      && fwrite(buf, 1, buf_len, fp) == buf_len;
+            if (fp && fclose(fp) != 0) ok = false;
+            if (! ok || rename(tmp, cache_path) != 0) {
+                remove(tmp);
+                sprintf(printbuf, "failed to write script cache %.60s", cache_path);
+                logging(LOG_INFO, printbuf);
+            }
+            free(tmp);
+        }
+    }
+    cache_off();
+    free(cache_path);
+    cache_path = NULL;
+}
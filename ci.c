@@ -9,11 +9,69 @@
 
 #include "ci.h"
 
+extern void set_input_line(const char *line);
+
+char **eval_exprs = NULL;
+int num_eval_exprs = 0;
+
+/* run_exprs() - evaluate the -e expressions in order. There is no banner or
+ * prompt, and the variable table is only made once a line needs it.
+ * Return value: The exit status described in ci.h. */
+static int run_exprs(void) {
+    char line[MAX_LINE_CHARS];
+    int status = EXIT_SUCCESS;
+    ci_prompt = "";
+    for (int i = 0; i < num_eval_exprs && ! terminate; i++) {
+        ignore_input = false;
+        last_error = ERR_OTHER;
+        input_lineno++;
+        size_t len = strlen(eval_exprs[i]);
+        if (len > MAX_LINE_CHARS - 2) {
+            sprintf(line, "max input size is %d characters", MAX_LINE_CHARS - 2);
+            logging(LOG_ERROR, line);
+            if (status == EXIT_SUCCESS) status = EXIT_FAILURE;
+            continue;
+        }
+        memcpy(line, eval_exprs[i], len);
+        strcpy(line + len, "\n");
+        if (! var_table && line[strspn(line, " \t")] == '@') init_table();
+        set_input_line(line);
+        node_t *nptr = read_and_parse();
+        infer_and_eval(nptr);
+        format_and_print(nptr);
+        cleanup(nptr);
+        if (status == EXIT_SUCCESS && last_error != ERR_OTHER)
+            status = EXIT_ERROR_KIND + last_error;
+    }
+    finalize();
+    return status;
+}
+
 int main(int argc, char* argv[]) {
     handle_args(argc, argv);
+    if (table_file && ! terminate) {
+        init_table();
+        int status = run_table();
+        flush_error_log();
+        delete_table();
+        return status;
+    }
+    if (watch_file && ! terminate) {
+        int status = run_watch();
+        flush_error_log();
+        return status;
+    }
+    if (eval_exprs && ! terminate) return run_exprs();
+    if (jobs && ! terminate) {
+        int status = run_jobs();
+        finalize();
+        return status;
+    }
     init();
+    if (pipelined) run_pipeline();
     while (! terminate) {
         ignore_input = false;
+        input_lineno++;
         node_t *nptr = read_and_parse();
         infer_and_eval(nptr);
         format_and_print(nptr);
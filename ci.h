@@ -30,6 +30,9 @@
 #include "node.h"
 #include "err_handler.h"
 #include "variable.h"
+#include "batch.h"
+#include "perf.h"
+#include "output.h"
 
 /* Function declarations
  * The following function declarations allow any file that #includes ci.h
@@ -48,6 +51,14 @@ extern void finalize(void);
 /* Provided function to format & print the answer of an expression. */
 extern void format_and_print(node_t *);
 
+/* Print an array value as [1, 2, 3], with the elements in the given format. */
+extern void print_array(const array_t *, char);
+
+/* Write a result, or an error of the given kind and tag, in output_format
+ * when it is ndjson or binary (output.c). */
+extern void print_record(node_t *);
+extern void print_error_record(err_type_t, const char *tag);
+
 /* Provided function to print the (sub)tree from a given node. */
 extern void print_tree(node_t *);
 
@@ -60,6 +71,11 @@ extern void init_lexer(void);
  * next_token. */
 extern void advance_lexer(void);
 
+/* init_lexer obtains each line from line_source, which reads infile with
+ * read_input_line unless the pipelined mode substitutes its own reader. */
+extern line_status_t read_input_line(char *);
+extern _Thread_local line_status_t (*line_source)(char *);
+
 /* (STUDENT TODO)
  * This function will use the provided lexer & the student's parse tree
  * implementation to parse input to the ci. You won't modify this specific
@@ -72,10 +88,140 @@ extern node_t *read_and_parse(void);
  * calls. */
 extern void infer_and_eval(node_t *);
 
+/* The steps of infer_and_eval, for callers that evaluate a tree repeatedly:
+ * infer_expr infers types once, eval_root evaluates, and reset_eval frees the
+ * computed values so eval_root can run again. */
+extern void infer_expr(node_t *);
+extern void eval_root(node_t *);
+extern void reset_eval(node_t *);
+
 /* (STUDENT TODO)
  * This function will free the memory allocated for a given parse tree. */
 extern void cleanup(node_t *);
 
+/* These functions store string values, inline when they are short (value.h).
+ * alloc_str and set_str return NULL/false after logging a failed allocation. */
+extern char *alloc_str(value_t *, size_t);
+extern bool set_str(value_t *, const char *);
+extern void free_str(value_t *);
+extern size_t str_len(const value_t *);
+extern _Thread_local unsigned long str_allocs;     // heap strings and arrays allocated so far
+
+/* These functions store array values and copy or free a value of any type.
+ * alloc_array and copy_value return NULL/false after logging a failed
+ * allocation. */
+extern int *alloc_array(value_t *, int);
+extern bool copy_value(value_t *, const value_t *, type_t);
+extern void free_value(value_t *, type_t);
+
+/* These functions manage the on-disk cache of parsed scripts (-c dir).
+ * cache_open hashes the input file and looks for a matching image,
+ * cache_replay hands back the next cached AST (returning false when the line
+ * must be read and parsed normally), cache_record adds a freshly parsed line
+ * to the image being built and cache_close writes it out. */
+extern void cache_open(char *dir, FILE *in);
+extern bool cache_replay(node_t **root);
+extern void cache_record(node_t *root);
+extern void cache_close(void);
+
+/* Tiered native execution of integer/boolean expressions. jit_eval evaluates
+ * an inferred expression with compiled code once its shape is hot, returning
+ * false if the interpreter must evaluate it instead. */
+extern bool jit_eval(node_t *);
+extern void jit_release(void);
+extern int jit_threshold;
+
+/* Memoization of expression results (memo.c). memo_lookup fills in the root
+ * of an expression line, returning true, if the line was evaluated before and
+ * none of the variables it reads have changed since; otherwise memo_store
+ * saves the result once the line has been evaluated. */
+extern bool memo_lookup(node_t *);
+extern void memo_store(node_t *);
+extern void memo_release(void);
+extern int memo_slots;
+extern bool memo_stats;
+
+/* Evaluate table_expr over every row of the delimited file table_file
+ * (--table/--expr). Returns the process exit status. */
+extern int run_table(void);
+extern char *table_file, *table_expr;
+
+/* Run the script watch_file, then run again the lines affected by each
+ * change to it until interrupted (--watch). Returns the exit status. */
+extern int run_watch(void);
+extern char *watch_file;
+
+/* Read-only variables shared between processes (--shared-vars name).
+ * publish_table publishes the table under that name (@share), shared_open maps
+ * what was published, and shared_get looks a variable up in it for get().
+ * shared_names sets names to the shared names in order and returns how many. */
+extern void publish_table(void);
+extern void shared_open(void);
+extern entry_t *shared_get(char *id);
+extern int shared_names(char ***names);
+extern char *shared_vars;
+
+/* Expressions given with -e, evaluated in order instead of reading infile.
+ * The exit status is then EXIT_SUCCESS, EXIT_ERROR_KIND plus the err_type_t
+ * of the first error handled, or EXIT_FAILURE for any other failure. */
+#define EXIT_ERROR_KIND 2
+extern char **eval_exprs;
+extern int num_eval_exprs;
+
+/* Run each of the num_job_files scripts in job_files on a pool of jobs
+ * threads (--jobs N), writing the results for file to file.out. Returns the
+ * exit status. */
+extern int run_jobs(void);
+extern int jobs;
+extern char **job_files;
+extern int num_job_files;
+
+/* Run the read/parse/evaluate/print loop as a pipeline of threads (-P). */
+extern void run_pipeline(void);
+extern bool pipelined;
+
+/* Timeline of interpreter phases (-T file). trace_start returns a start
+ * time, or 0 when tracing is off, and trace_event records an event named
+ * name (a string literal) from then until now. trace_close writes the file. */
+extern unsigned long trace_start(void);
+extern void trace_event(const char *name, unsigned long start);
+extern void trace_close(void);
+extern char *trace_file;
+
+/* Hardware performance counters per phase (--perf-counters). perf_begin and
+ * perf_end bracket a phase on the calling thread, and perf_report prints the
+ * totals on errfile. perf_thread_exit closes the counters of the calling
+ * thread, and is called by each thread that ran a phase before it exits. */
+extern void perf_begin(phase_t);
+extern void perf_end(phase_t);
+extern void perf_report(void);
+extern void perf_thread_exit(void);
+extern bool perf_counters;
+
+/* Built-in functions on strings and arrays (builtin.c). find_builtin returns the index of
+ * the function called name, or -1. builtin_type sets the type of a call
+ * node from its arguments, returning false if they do not fit, and
+ * call_builtin evaluates a call whose arguments have been evaluated. */
+extern int find_builtin(const char *name);
+extern int builtin_arity(int fn);
+extern const char *builtin_name(int fn);
+extern bool builtin_type(node_t *call);
+extern void call_builtin(node_t *call);
+
+/* Integer array operators (array.c). array_binop applies +, -, *, /, %, <, >
+ * or ~ element by element, broadcasting a scalar operand, and array_neg
+ * negates every element. Both report mismatched lengths and zero divisors as
+ * ERR_EVAL at the right operand. The reductions need a non-empty array, except
+ * array_sum. */
+extern void array_binop(token_t tok, value_t *value, node_t *left, node_t *right);
+extern void array_neg(value_t *value, node_t *operand);
+extern int array_sum(const array_t *);
+extern int array_min(const array_t *);
+extern int array_max(const array_t *);
+
+/* Time repeated evaluations of an expression (@bench N expr). */
+extern void run_bench(long runs, char *expr);
+
 /* (EEL-2) These functions will perform variable insertion or searching in a
  * hashtable. You won't touch these until finishing EEL-1. */
 void put(char *id, node_t *nptr);
@@ -88,10 +234,15 @@ extern entry_t* get(char* id);
 
 /* The infile, outfile, and errfile variables are all used to tell the program 
  * where to obtain input, where to place output, and where to log errors. They
- * are similar to Java's System.in, System.out, and System.err. */
-extern FILE *infile;
-extern FILE *outfile;
-extern FILE *errfile;
+ * are similar to Java's System.in, System.out, and System.err. Each thread
+ * has its own, so that --jobs can run several inputs at once. */
+extern _Thread_local FILE *infile;
+extern _Thread_local FILE *outfile;
+extern _Thread_local FILE *errfile;
+
+/* True if the final destination of outfile is stdout. In pipelined mode
+ * outfile points at per-line buffers, so this is tracked separately. */
+extern bool to_stdout;
 
 /* This is a string containing the prompt that will be displayed by the ci. */
 extern char *ci_prompt;
@@ -99,12 +250,14 @@ extern char *ci_prompt;
 /* These variables are pointers to "lexeme" structs, defined in token.h. They
  * are updated by calls to init_lexer and advance_lexer. More information about
  * the lexeme struct can be found in token.h. */
-extern lptr_t this_token, next_token;
+extern _Thread_local lptr_t this_token, next_token;
 
 /* These are booleans used to control program execution.
  * If ignore_input is true, the current input will no longer be processed. 
- * If terminate is true, the ci program will terminate. */
-extern bool terminate, ignore_input;
+ * If terminate is true, the ci program will terminate.
+ * Each thread of the pipelined mode has its own copy. */
+extern _Thread_local bool terminate, ignore_input;
 
-/* (EEL-2) The hashtable storing all defined variables. */
-extern table_t *var_table;
+/* (EEL-2) The hashtable storing all defined variables. Each thread has its
+ * own; the pipelined mode hands the main thread's to its evaluator. */
+extern _Thread_local table_t *var_table;
@@ -15,8 +15,29 @@ if [ ! -f "$TESTFILE" ]; then
     exit 1
 fi
 
-./ci -i $TESTFILE -o _output1
-./ci_reference -i $1 -o _output2
+# A test of a feature ci_reference lacks comes with the output it must
+# produce, test_x.expected: what ci writes to _output1, followed by what it
+# logs. It may also come with the commands that run it, test_x.cmd, in place
+# of "./ci -i $TESTFILE -o _output1".
+BASE=${TESTFILE%.txt}
+CMD="./ci -i $TESTFILE -o _output1"
+if [ -f "$BASE.cmd" ]; then
+    CMD=$(cat "$BASE.cmd")
+fi
+if [ -f "$BASE.expected" ]; then
+    eval "$CMD" 2> _errors || true
+    # --jobs writes the results for each script next to it
+    if [ -f "$TESTFILE.out" ]; then
+        mv "$TESTFILE.out" _output1
+        rm -f "$(dirname "$TESTFILE")"/*.txt.out
+    fi
+    cat _errors >> _output1
+    cp "$BASE.expected" _output2
+    rm -f _errors
+else
+    ./ci -i $TESTFILE -o _output1
+    ./ci_reference -i $1 -o _output2
+fi
 if [ ! -f _output1 ]; then
     echo "ci failed to create the output file"
     exit 1
@@ -26,7 +47,16 @@ if [ ! -f _output2 ]; then
     exit 1
 fi
 
-DIFFS=$(grep -n -v -f _output1 _output2 | cut -d ":" -f 1)
+if [ -f "$BASE.expected" ]; then
+    # the lines of the expected output that ci did not produce in place
+    DIFFS=$(diff -a --old-line-format="%dn
+" --new-line-format="" --unchanged-line-format="" _output2 _output1 || true)
+    if [ -z "$DIFFS" ] && ! cmp -s _output1 _output2; then
+        DIFFS=$(($(wc -l < _output2) + 1))
+    fi
+else
+    DIFFS=$(grep -n -v -f _output1 _output2 | cut -d ":" -f 1)
+fi
 if [ "$DIFFS" ] 
 then
     echo "failed testcases:"
@@ -38,8 +68,9 @@ then
     GOLD=$(sed -n "${line}p" _output2)
     echo -e "$line | $EXP | $OUTPUT | $GOLD"
     done
-else
-    echo "all testcases passed"
+    rm -f _output1 _output2
+    exit 1
 fi
 
+echo "all testcases passed"
 rm -f _output1 _output2
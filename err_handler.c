@@ -10,10 +10,10 @@
 #include "ci.h"
 #include "ansicolors.h"
 
-bool terminate = false;
-bool ignore_input = false;
+_Thread_local bool terminate = false;
+_Thread_local bool ignore_input = false;
 
-static char printbuf[100];
+static _Thread_local char printbuf[100];
 
 static char *sevnames[LOG_FATAL+1] = {
     "INFO",
@@ -37,6 +37,30 @@ static char *errnames[ERR_UNDEFINED+1] = {
     "Undefined Variable"
 };
 
+/* The messages handle_error writes to outfile, preformatted. */
+#define ERR_LINE(name) "\tERROR: " name "\n"
+#define ERR_LINES(name) { ERR_LINE(name), ANSI_COLOR_RED ERR_LINE(name) ANSI_RESET }
+static const char *errlines[ERR_UNDEFINED+1][2] = {
+    ERR_LINES("Failed Lexical Analysis"),
+    ERR_LINES("Failed Syntactic Analysis"),
+    ERR_LINES("Failed Type Inference"),
+    ERR_LINES("Failed Evaluation"),
+    ERR_LINES("Undefined Variable")
+};
+
+static const char *errtags[ERR_UNDEFINED+1] = {
+    "LEX", "SYNTAX", "TYPE", "EVAL", "UNDEFINED"
+};
+
+#define ERR_LOG_SIZE 256
+
+err_log_fmt_t err_log_format = ERRLOG_OFF;
+_Thread_local unsigned long input_lineno = 0;
+_Thread_local err_type_t last_error = ERR_OTHER;
+
+static _Thread_local err_record_t err_log[ERR_LOG_SIZE];
+static _Thread_local int err_log_len = 0;
+
 
 static char* format_log_message(log_lev_t sev, char *msg) {
     sprintf(printbuf, "%s\t[%s] %s" ANSI_RESET, sevcolors[sev], sevnames[sev], msg);
@@ -60,18 +84,87 @@ int logging(log_lev_t sev, char* msg) {
         default:
             break;
     }
-    if (outfile != stdout && sev == LOG_ERROR) {
+    if (sev == LOG_ERROR && output_format != OUTPUT_TEXT) {
+        print_error_record(ERR_OTHER, "OTHER");
+    } else if (! to_stdout && sev == LOG_ERROR) {
         fprintf(outfile, "\t[ERROR]\n");
     }
     return fprintf(errfile, "%s\n", format_log_message(sev, msg));
 }
 
-int handle_error(err_type_t err) {
+/* Append the decimal digits of v to p and return the new end. */
+static char *put_num(char *p, long v) {
+    char digits[24];
+    int n = 0;
+    if (v < 0) {
+        *p++ = '-';
+        v = -v;
+    }
+    do {
+        digits[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    while (n) *p++ = digits[--n];
+    return p;
+}
+
+static char *put_str(char *p, const char *s) {
+    while (*s) *p++ = *s++;
+    return p;
+}
+
+void flush_error_log(void) {
+    if (err_log_len == 0) return;
+
+    /* longest record: two numbers, a name and punctuation */
+    static _Thread_local char out[ERR_LOG_SIZE * 80];
+    char *p = out;
+    for (int i = 0; i < err_log_len; i++) {
+        err_record_t *r = &err_log[i];
+        if (err_log_format == ERRLOG_TEXT) {
+            p = put_str(p, "line ");
+            p = put_num(p, r->line);
+            if (r->pos >= 0) {
+                p = put_str(p, ", col ");
+                p = put_num(p, r->pos + 1);
+            }
+            p = put_str(p, ": ");
+            p = put_str(p, errnames[(int) r->kind]);
+        } else {
+            p = put_num(p, r->line);
+            *p++ = '\t';
+            p = put_num(p, r->pos + 1);
+            *p++ = '\t';
+            p = put_str(p, errtags[(int) r->kind]);
+            *p++ = '\t';
+            p = put_num(p, r->tok);
+        }
+        *p++ = '\n';
+    }
+    fwrite(out, 1, p - out, errfile);
+    err_log_len = 0;
+}
+
+int handle_error_at(err_type_t err, token_t tok, int pos) {
     if (ignore_input) return 0;
 
     ignore_input = true;
-    if (outfile != stdout) {
-        return fprintf(outfile, "\tERROR: %s\n", errnames[err]);
+    last_error = err;
+    if (err_log_format != ERRLOG_OFF) {
+        if (err_log_len == ERR_LOG_SIZE) flush_error_log();
+        err_record_t *r = &err_log[err_log_len++];
+        r->line = input_lineno;
+        r->pos = pos;
+        r->kind = err;
+        r->tok = tok;
+    }
+    if (output_format != OUTPUT_TEXT) {
+        print_error_record(err, errtags[err]);
+        return 0;
     }
-    return fprintf(outfile, ANSI_COLOR_RED "\tERROR: %s\n" ANSI_RESET, errnames[err]);
+    return fputs(errlines[err][to_stdout], outfile);
+}
+
+int handle_error(err_type_t err) {
+    return handle_error_at(err, TOK_INVALID, -1);
 }
@@ -30,6 +30,30 @@ typedef enum {
 } err_type_t;
 
 
+/* A compact record of one input error, kept for the error log. */
+typedef struct err_record {
+    unsigned long line;     // input line number, counting from 1
+    short pos;              // position of the offending token, or -1
+    signed char kind;       // err_type_t
+    signed char tok;        // token_t of the offending token or node
+} err_record_t;
+
+/* Formats in which error records can be written to errfile. */
+typedef enum {
+    ERRLOG_OFF,     // records are not written (default)
+    ERRLOG_TEXT,    // "line 3, col 7: Failed Type Inference"
+    ERRLOG_LINES    // "3\t7\tTYPE\t9", tab-separated for machines
+} err_log_fmt_t;
+
+extern err_log_fmt_t err_log_format;
+
+/* The number of the input line being processed. */
+extern _Thread_local unsigned long input_lineno;
+
+/* The kind of the last error reported by handle_error, or ERR_OTHER if there
+ * was none since the caller reset it. */
+extern _Thread_local err_type_t last_error;
+
 /* This function will log information to the console given a log_lev_t enum
  * and a log string. Use it for system level errors or debugging info. Output 
  * created by this function will not affect grading. */
@@ -42,3 +66,10 @@ extern int logging(log_lev_t, char*);
  * The program should print a type reference error and ignore the evaluation
  * error. */
 extern int handle_error(err_type_t);
+
+/* Like handle_error, but records the token and input position at fault. */
+extern int handle_error_at(err_type_t, token_t, int);
+
+/* Write out the error records collected so far. Records are buffered in a
+ * fixed array without allocating and written in batches. */
+extern void flush_error_log(void);
@@ -13,64 +13,135 @@
 
 extern bool is_binop(token_t);
 extern bool is_unop(token_t);
-char *strrev(char *str);
-static void add(value_t *value, node_t *left, node_t *right);
-static void subtract(value_t *value, node_t *left, node_t *right);
-static void multiply(value_t *value, node_t *left, node_t *right);
-static void divide(value_t *value, node_t *left, node_t *right);
-static void modulo(value_t *value, node_t *left, node_t *right);
-static void and(value_t *value, node_t *left, node_t *right);
-static void or(value_t *value, node_t *left, node_t *right);
-static void lessThan(value_t *value, node_t *left, node_t *right);
-static void greaterThan(value_t *value, node_t *left, node_t *right);
-static void equals(value_t *value, node_t *left, node_t *right);
-
-// TODO TODO****: Paste new tarball files from canvas into the directory
-
-// Lists valid types for each binop operator
-// Can access the correct list by calling binopTypes[(Token) - TOK_PLUS]
+static void strrev(value_t *value, const value_t *str);
+
+/* String operators building at least this many characters are traced (-T). */
+#define TRACE_MIN_STR 4096
+
+typedef void (*handler_t)(value_t *value, node_t *left, node_t *right);
+
+static void int_add(value_t *value, node_t *left, node_t *right);
+static void str_concat(value_t *value, node_t *left, node_t *right);
+static void int_sub(value_t *value, node_t *left, node_t *right);
+static void int_mul(value_t *value, node_t *left, node_t *right);
+static void str_repeat(value_t *value, node_t *left, node_t *right);
+static void int_div(value_t *value, node_t *left, node_t *right);
+static void int_mod(value_t *value, node_t *left, node_t *right);
+static void bool_and(value_t *value, node_t *left, node_t *right);
+static void bool_or(value_t *value, node_t *left, node_t *right);
+static void int_lt(value_t *value, node_t *left, node_t *right);
+static void str_lt(value_t *value, node_t *left, node_t *right);
+static void int_gt(value_t *value, node_t *left, node_t *right);
+static void str_gt(value_t *value, node_t *left, node_t *right);
+static void int_eq(value_t *value, node_t *left, node_t *right);
+static void str_eq(value_t *value, node_t *left, node_t *right);
+static void int_neg(value_t *value, node_t *left, node_t *right);
+static void str_rev(value_t *value, node_t *left, node_t *right);
+static void bool_not(value_t *value, node_t *left, node_t *right);
+static void arr_add(value_t *value, node_t *left, node_t *right);
+static void arr_sub(value_t *value, node_t *left, node_t *right);
+static void arr_mul(value_t *value, node_t *left, node_t *right);
+static void arr_div(value_t *value, node_t *left, node_t *right);
+static void arr_mod(value_t *value, node_t *left, node_t *right);
+static void arr_lt(value_t *value, node_t *left, node_t *right);
+static void arr_gt(value_t *value, node_t *left, node_t *right);
+static void arr_eq(value_t *value, node_t *left, node_t *right);
+static void arr_neg(value_t *value, node_t *left, node_t *right);
+
+// Valid operand types for each operator, and the handler for each combination.
+// infer_type() stores the index + 1 of the matching row in the node's op
+// field, so eval_node() calls the handler without checking types again.
+// Unary operators have NO_TYPE as their right operand type. The array rows
+// at the end take an integer on either side, which is broadcast (array.c).
 static const struct {
-    token_t binopTok;
-    void (*func_ptr)(value_t *value, node_t *left, node_t *right);
-    int numValid;
-    node_type_t types[2];
-} binopTypes[] = {
-    {TOK_PLUS,   &add,  2,    {INT_TYPE, STRING_TYPE}},              // +
-    {TOK_BMINUS, &subtract, 1,    {INT_TYPE}},                           // -
-    {TOK_TIMES,  &multiply, 2,    {INT_TYPE, STRING_TYPE}},              // *
-    {TOK_DIV,    &divide, 1,    {INT_TYPE}},                           // /
-    {TOK_MOD,    &modulo, 1,    {INT_TYPE}},                           // %
-    {TOK_AND,    &and, 1,    {BOOL_TYPE}},                          // &
-    {TOK_OR,     &or, 1,    {BOOL_TYPE}},                          // |
-    {TOK_LT,     &lessThan, 2,    {INT_TYPE, STRING_TYPE}},              // <
-    {TOK_GT,     &greaterThan, 2,    {INT_TYPE, STRING_TYPE}},              // >
-    {TOK_EQ,     &equals, 2,    {INT_TYPE, STRING_TYPE}}               // ~
+    token_t tok;
+    type_t left, right;     // operand types
+    type_t result;          // type of the result
+    handler_t func_ptr;
+} handlers[] = {
+    {TOK_PLUS,   INT_TYPE,    INT_TYPE,    INT_TYPE,    &int_add},      // +
+    {TOK_PLUS,   STRING_TYPE, STRING_TYPE, STRING_TYPE, &str_concat},
+    {TOK_BMINUS, INT_TYPE,    INT_TYPE,    INT_TYPE,    &int_sub},      // -
+    {TOK_TIMES,  INT_TYPE,    INT_TYPE,    INT_TYPE,    &int_mul},      // *
+    {TOK_TIMES,  STRING_TYPE, INT_TYPE,    STRING_TYPE, &str_repeat},
+    {TOK_DIV,    INT_TYPE,    INT_TYPE,    INT_TYPE,    &int_div},      // /
+    {TOK_MOD,    INT_TYPE,    INT_TYPE,    INT_TYPE,    &int_mod},      // %
+    {TOK_AND,    BOOL_TYPE,   BOOL_TYPE,   BOOL_TYPE,   &bool_and},     // &
+    {TOK_OR,     BOOL_TYPE,   BOOL_TYPE,   BOOL_TYPE,   &bool_or},      // |
+    {TOK_LT,     INT_TYPE,    INT_TYPE,    BOOL_TYPE,   &int_lt},       // <
+    {TOK_LT,     STRING_TYPE, STRING_TYPE, BOOL_TYPE,   &str_lt},
+    {TOK_GT,     INT_TYPE,    INT_TYPE,    BOOL_TYPE,   &int_gt},       // >
+    {TOK_GT,     STRING_TYPE, STRING_TYPE, BOOL_TYPE,   &str_gt},
+    {TOK_EQ,     INT_TYPE,    INT_TYPE,    BOOL_TYPE,   &int_eq},       // ~
+    {TOK_EQ,     STRING_TYPE, STRING_TYPE, BOOL_TYPE,   &str_eq},
+    {TOK_UMINUS, INT_TYPE,    NO_TYPE,     INT_TYPE,    &int_neg},      // _
+    {TOK_UMINUS, STRING_TYPE, NO_TYPE,     STRING_TYPE, &str_rev},
+    {TOK_NOT,    BOOL_TYPE,   NO_TYPE,     BOOL_TYPE,   &bool_not},     // !
+    {TOK_PLUS,   ARRAY_TYPE,  ARRAY_TYPE,  ARRAY_TYPE,  &arr_add},
+    {TOK_PLUS,   ARRAY_TYPE,  INT_TYPE,    ARRAY_TYPE,  &arr_add},
+    {TOK_PLUS,   INT_TYPE,    ARRAY_TYPE,  ARRAY_TYPE,  &arr_add},
+    {TOK_BMINUS, ARRAY_TYPE,  ARRAY_TYPE,  ARRAY_TYPE,  &arr_sub},
+    {TOK_BMINUS, ARRAY_TYPE,  INT_TYPE,    ARRAY_TYPE,  &arr_sub},
+    {TOK_BMINUS, INT_TYPE,    ARRAY_TYPE,  ARRAY_TYPE,  &arr_sub},
+    {TOK_TIMES,  ARRAY_TYPE,  ARRAY_TYPE,  ARRAY_TYPE,  &arr_mul},
+    {TOK_TIMES,  ARRAY_TYPE,  INT_TYPE,    ARRAY_TYPE,  &arr_mul},
+    {TOK_TIMES,  INT_TYPE,    ARRAY_TYPE,  ARRAY_TYPE,  &arr_mul},
+    {TOK_DIV,    ARRAY_TYPE,  ARRAY_TYPE,  ARRAY_TYPE,  &arr_div},
+    {TOK_DIV,    ARRAY_TYPE,  INT_TYPE,    ARRAY_TYPE,  &arr_div},
+    {TOK_DIV,    INT_TYPE,    ARRAY_TYPE,  ARRAY_TYPE,  &arr_div},
+    {TOK_MOD,    ARRAY_TYPE,  ARRAY_TYPE,  ARRAY_TYPE,  &arr_mod},
+    {TOK_MOD,    ARRAY_TYPE,  INT_TYPE,    ARRAY_TYPE,  &arr_mod},
+    {TOK_MOD,    INT_TYPE,    ARRAY_TYPE,  ARRAY_TYPE,  &arr_mod},
+    {TOK_LT,     ARRAY_TYPE,  ARRAY_TYPE,  ARRAY_TYPE,  &arr_lt},
+    {TOK_LT,     ARRAY_TYPE,  INT_TYPE,    ARRAY_TYPE,  &arr_lt},
+    {TOK_LT,     INT_TYPE,    ARRAY_TYPE,  ARRAY_TYPE,  &arr_lt},
+    {TOK_GT,     ARRAY_TYPE,  ARRAY_TYPE,  ARRAY_TYPE,  &arr_gt},
+    {TOK_GT,     ARRAY_TYPE,  INT_TYPE,    ARRAY_TYPE,  &arr_gt},
+    {TOK_GT,     INT_TYPE,    ARRAY_TYPE,  ARRAY_TYPE,  &arr_gt},
+    {TOK_EQ,     ARRAY_TYPE,  ARRAY_TYPE,  ARRAY_TYPE,  &arr_eq},
+    {TOK_EQ,     ARRAY_TYPE,  INT_TYPE,    ARRAY_TYPE,  &arr_eq},
+    {TOK_EQ,     INT_TYPE,    ARRAY_TYPE,  ARRAY_TYPE,  &arr_eq},
+    {TOK_UMINUS, ARRAY_TYPE,  NO_TYPE,     ARRAY_TYPE,  &arr_neg}
 };
 
+/* node_error() - report an error at the position of the node at fault */
+static void node_error(err_type_t err, node_t *nptr) {
+    handle_error_at(err, nptr->tok, nptr->pos);
+}
+
 void resolve_variable(node_t *nptr) {
-    entry_t* var = get(nptr->val.sval);
+    entry_t* var = get(STR_VAL(nptr->val));
 
     if(var == NULL) {
-        handle_error(ERR_UNDEFINED);
+        node_error(ERR_UNDEFINED, nptr);
         return;
     }
 
+    // the name is no longer needed once the value replaces it
+    free_str(&nptr->val);
     nptr->type = var->type;
 
-    if(nptr->type == STRING_TYPE) {
-        nptr->val.sval = (char *) malloc(strlen(var->val.sval) + 1);
-        if (! nptr->val.sval) {
-            logging(LOG_FATAL, "failed to allocate string");
-            return;
-        }
-        strcpy(nptr->val.sval, var->val.sval);
-    } else {
-        nptr->val.ival = var->val.ival;
-    }
+    copy_value(&nptr->val, &var->val, var->type);
 
     return;
 }
 
+/* select_handler() - find the handler for an operator node's operand types
+ * Return value: false if the operator does not accept these types.
+ * Side effect: The type and op fields of the node are set.
+ */
+static bool select_handler(node_t *nptr, type_t left, type_t right) {
+    for(int i = 0; i < sizeof(handlers) / sizeof(handlers[0]); i++) {
+        if(handlers[i].tok == nptr->tok && handlers[i].left == left
+           && handlers[i].right == right) {
+            nptr->type = handlers[i].result;
+            nptr->op = i + 1;
+            return true;
+        }
+    }
+    return false;
+}
+
 /* infer_type() - set the type of a non-root node based on the types of children
  * Parameter: A node pointer, possibly NULL.
  * Return value: None.
@@ -81,100 +152,42 @@ void resolve_variable(node_t *nptr) {
 static void infer_type(node_t *nptr) {
     if(nptr == NULL) return;
     if (terminate || ignore_input) return;
+    // shared subtrees are inferred once
+    if(nptr->flags & NODE_INFERRED) return;
+    nptr->flags |= NODE_INFERRED;
 
     if(nptr->node_type == NT_INTERNAL) {
         for (int i = 0; i < 3; ++i) {
             infer_type(nptr->children[i]);
         }
 
-        // Handle unary operator
-        if(is_unop(nptr->tok)) {
-            if(nptr->children[0] == NULL) {
-                handle_error(ERR_SYNTAX);
-                return;
-            }
-            if(nptr->tok == TOK_UMINUS) {
-                if(nptr->children[0]->type == INT_TYPE) {
-                    nptr->type = INT_TYPE;
-                } else if(nptr->children[0]->type == STRING_TYPE) {
-                    nptr->type = STRING_TYPE;
-                } else {
-                    handle_error(ERR_TYPE);
-                    return;
-                }
+        // Handle unary and binary operators
+        if(is_unop(nptr->tok) || is_binop(nptr->tok)) {
+            bool unary = is_unop(nptr->tok);
+            if(nptr->children[0] == NULL || (! unary && nptr->children[1] == NULL)) {
+                node_error(ERR_SYNTAX, nptr);
                 return;
             }
 
-            if(nptr->tok == TOK_NOT) {
-                if(nptr->children[0]->type != BOOL_TYPE) {
-                    handle_error(ERR_TYPE);
-                    return;
-                }
-
-                nptr->type = BOOL_TYPE;
-                return;
+            type_t right = unary ? NO_TYPE : nptr->children[1]->type;
+            if(! select_handler(nptr, nptr->children[0]->type, right)) {
+                node_error(ERR_TYPE, nptr);
             }
+            return;
         }
 
-        // Handle binary operator
-        if(is_binop(nptr->tok)) {
-            if(nptr->children[0] == NULL || nptr->children[1] == NULL) {
-                handle_error(ERR_SYNTAX);
-                return;
-            }
-            
-            // Special case
-            // String times operator allows different types
-            if(nptr->tok == TOK_TIMES) {
-                // 2nd argument must be an int
-                if(nptr->children[1]->type != INT_TYPE) {
-                    handle_error(ERR_TYPE);
-                    return;
-                }
-
-                if(nptr->children[0]->type == INT_TYPE) {
-                    nptr->type = INT_TYPE;
-                    return;
-                } else if(nptr->children[0]->type == STRING_TYPE) {
-                    nptr->type = STRING_TYPE;
-                    return;
-                }
-
-                handle_error(ERR_TYPE);
-                return;
-            } else {
-                // All other tokens
-                if(nptr->children[0]->type != nptr->children[1]->type) {
-                    handle_error(ERR_TYPE);
-                }
-
-                node_type_t childrenType = nptr->children[0]->type;
-                int index = nptr->tok - TOK_PLUS;
-            
-                for(int i = 0; i < binopTypes[index].numValid; i++) {
-                    if(childrenType == binopTypes[index].types[i]) {
-                        if(nptr->tok == TOK_GT || nptr->tok == TOK_LT || nptr->tok == TOK_EQ) {
-                            nptr->type = BOOL_TYPE;
-                        } else {
-                            nptr->type = childrenType;
-                        }
-                        
-                        return;
-                    }
-                }
+        // Handle built-in function calls
+        if(nptr->tok == TOK_CALL) {
+            if(! builtin_type(nptr)) {
+                node_error(ERR_TYPE, nptr);
             }
-
-            
-
-            
-
-            handle_error(ERR_TYPE);
+            return;
         }
 
         // Handle ternary operator
         if(nptr->tok == TOK_QUESTION) {
             if(nptr->children[0]->type != BOOL_TYPE) {
-                handle_error(ERR_TYPE);
+                node_error(ERR_TYPE, nptr);
                 return;
             }
 
@@ -183,7 +196,7 @@ static void infer_type(node_t *nptr) {
                 return;
             }
 
-            handle_error(ERR_TYPE);
+            node_error(ERR_TYPE, nptr);
             return;
 
         }
@@ -218,7 +231,7 @@ static void infer_root(node_t *nptr) {
             infer_type(nptr->children[i]);
         }
         if (nptr->children[0] == NULL) {
-            handle_error(ERR_SYNTAX);
+            node_error(ERR_SYNTAX, nptr);
             return;
         }
         nptr->type = nptr->children[0]->type;
@@ -226,215 +239,162 @@ static void infer_root(node_t *nptr) {
     return;
 }
 
-/* add() - Adds the values of the left and right nodes based on their type and 
- * stores the result in value
+/* The handlers below are only called on operands of the types listed for
+ * them in handlers[], so they do not check types.
  */
-static void add(value_t *value, node_t *left, node_t *right) {
-    if(left->type != right->type) {
-        handle_error(ERR_TYPE);
-        return;
-    }
-
-    if(left->type == INT_TYPE) {
-        value->ival = left->val.ival + right->val.ival;
-        return;
-    }
-    if(left->type == STRING_TYPE) {
-        value->sval = (char *) malloc(strlen(left->val.sval) + strlen(right->val.sval) + 1);
-        if (! value->sval) {
-            logging(LOG_FATAL, "failed to allocate string");
-            return;
-        }
-                        
-        strcpy(value->sval, left->val.sval);
-        strcat(value->sval, right->val.sval);
-        return;
-    }
 
-    handle_error(ERR_TYPE);
-    return;
+static void int_add(value_t *value, node_t *left, node_t *right) {
+    value->ival = left->val.ival + right->val.ival;
 }
 
-// subtract() - Subtracts the int value of right from left and stores it in value.
-static void subtract(value_t *value, node_t *left, node_t *right) {
-    if(left->type != INT_TYPE || right->type != INT_TYPE) {
-        handle_error(ERR_TYPE);
-        return;
-    }
+/* str_concat() - Concatenates the left and right strings. */
+static void str_concat(value_t *value, node_t *left, node_t *right) {
+    size_t llen = str_len(&left->val), rlen = str_len(&right->val);
+    unsigned long start = llen + rlen >= TRACE_MIN_STR ? trace_start() : 0;
+    char *buf = alloc_str(value, llen + rlen);
+    if (! buf) return;
+
+    memcpy(buf, STR_VAL(left->val), llen);
+    memcpy(buf + llen, STR_VAL(right->val), rlen);
+    trace_event("concat", start);
+}
 
+static void int_sub(value_t *value, node_t *left, node_t *right) {
     value->ival = left->val.ival - right->val.ival;
-    return;
 }
 
-// multiply() - TODO
-static void multiply(value_t *value, node_t *left, node_t *right) {
-    if(right->type != INT_TYPE) {
-        handle_error(ERR_TYPE);
-        return;
-    }
+static void int_mul(value_t *value, node_t *left, node_t *right) {
+    value->ival = left->val.ival * right->val.ival;
+}
 
-    // Handle ints
-    if(left->type == INT_TYPE) {
-        value->ival = left->val.ival * right->val.ival;
+/* str_repeat() - Repeats the left string right times. Causes an evaluation
+ * error if the count is negative.
+ */
+static void str_repeat(value_t *value, node_t *left, node_t *right) {
+    if(right->val.ival < 0) {
+        node_error(ERR_EVAL, right);
         return;
     }
+    size_t len = str_len(&left->val);
+    unsigned long start = len * right->val.ival >= TRACE_MIN_STR ? trace_start() : 0;
+    char *buf = alloc_str(value, len * right->val.ival);
+    if (! buf) return;
 
-    // Handle Strings
-    if(left->type == STRING_TYPE) {
-        if(right->val.ival < 0) {
-            handle_error(ERR_EVAL);
-            return;
-        }
-        value->sval = (char *) malloc((strlen(left->val.sval) * right->val.ival) + 1);
-        if (! value->sval) {
-            logging(LOG_FATAL, "failed to allocate string");
-            return;
-        }
-
-        strcpy(value->sval, "");
-
-        for(int i = 0; i < right->val.ival; i++) {
-            strcat(value->sval, left->val.sval);
-        }
-        return;
+    for(int i = 0; i < right->val.ival; i++) {
+        memcpy(buf + i * len, STR_VAL(left->val), len);
     }
-
-    handle_error(ERR_TYPE);
-    return;
+    trace_event("repeat", start);
 }
 
-/* divide() - Divides the value of left by the value of right
- * and stores it in value. Causes an evaluation error if dividing
- * by 0.
+/* int_div() - Divides the value of left by the value of right. Causes an
+ * evaluation error if dividing by 0.
  */
-static void divide(value_t *value, node_t *left, node_t *right) {
-    if(left->type != INT_TYPE || right->type != INT_TYPE) {
-        handle_error(ERR_TYPE);
-        return;
-    }
-
+static void int_div(value_t *value, node_t *left, node_t *right) {
     if(right->val.ival == 0) {
-        handle_error(ERR_EVAL);
+        node_error(ERR_EVAL, right);
         return;
     }
-
     value->ival = left->val.ival / right->val.ival;
-    return;
 }
 
-/* modulo() - Calculates the modulo of the left value by the right value
- * and  stores it in value. Causes an evaluation error if modulo by 0.
+/* int_mod() - Calculates the modulo of the left value by the right value.
+ * Causes an evaluation error if modulo by 0.
  */
-static void modulo(value_t *value, node_t *left, node_t *right) {
-    if(left->type != INT_TYPE || right->type != INT_TYPE) {
-        handle_error(ERR_TYPE);
-        return;
-    }
-
+static void int_mod(value_t *value, node_t *left, node_t *right) {
     if(right->val.ival == 0) {
-        handle_error(ERR_EVAL);
+        node_error(ERR_EVAL, right);
         return;
     }
-
     value->ival = left->val.ival % right->val.ival;
-    return;
 }
 
-/* and() - Calculates the AND of the left and right bool values and
- * stores it in value
- */
-static void and(value_t *value, node_t *left, node_t *right) {
-    if(left->type != BOOL_TYPE || right->type != BOOL_TYPE) {
-        handle_error(ERR_TYPE);
-        return;
-    }
-
+static void bool_and(value_t *value, node_t *left, node_t *right) {
     value->bval = left->val.bval && right->val.bval;
-    return;
 }
 
-/* or() - Calculates the OR of the left and right bool values and
- * stores it in value
- */
-static void or(value_t *value, node_t *left, node_t *right) {
-    if(left->type != BOOL_TYPE || right->type != BOOL_TYPE) {
-        handle_error(ERR_TYPE);
-        return;
-    }
-
+static void bool_or(value_t *value, node_t *left, node_t *right) {
     value->bval = left->val.bval || right->val.bval;
-    return;
 }
 
-/* lessThan() - Compares either two ints or two strings lexigraphically
- * and stores true in value if left is less than right.
- */
-static void lessThan(value_t *value, node_t *left, node_t *right) {
+static void int_lt(value_t *value, node_t *left, node_t *right) {
+    value->bval = left->val.ival < right->val.ival;
+}
 
-    strcmp("abd", "abc");
+/* str_lt(), str_gt() - Compare two strings lexicographically. */
+static void str_lt(value_t *value, node_t *left, node_t *right) {
+    value->bval = strcmp(STR_VAL(left->val), STR_VAL(right->val)) < 0;
+}
 
-    if(left->type != right->type) {
-        handle_error(ERR_TYPE);
-        return;
-    }
+static void int_gt(value_t *value, node_t *left, node_t *right) {
+    value->bval = left->val.ival > right->val.ival;
+}
 
-    if(left->type == INT_TYPE) {
-        value->bval = left->val.ival < right->val.ival;
-        return;
-    }
-    if(left->type == STRING_TYPE) {
-        value->bval = strcmp(left->val.sval, right->val.sval) < 0;;
-        return;
-    }
+static void str_gt(value_t *value, node_t *left, node_t *right) {
+    value->bval = strcmp(STR_VAL(left->val), STR_VAL(right->val)) > 0;
+}
 
-    handle_error(ERR_TYPE);
-    return;
+static void int_eq(value_t *value, node_t *left, node_t *right) {
+    value->bval = left->val.ival == right->val.ival;
 }
 
-/* greaterThan() - Compares either two ints or two strings lexigraphically
- * and stores true in value if left is greater than right.
- */
-static void greaterThan(value_t *value, node_t *left, node_t *right) {
-    if(left->type != right->type) {
-        handle_error(ERR_TYPE);
+static void str_eq(value_t *value, node_t *left, node_t *right) {
+    // inline strings of different lengths cannot be equal
+    if (left->val.slen != right->val.slen
+        && STR_INLINE(left->val) && STR_INLINE(right->val)) {
+        value->bval = false;
         return;
     }
+    value->bval = strcmp(STR_VAL(left->val), STR_VAL(right->val)) == 0;
+}
 
-    if(left->type == INT_TYPE) {
-        value->bval = left->val.ival > right->val.ival;
-        return;
-    }
-    if(left->type == STRING_TYPE) {
-        value->bval = strcmp(left->val.sval, right->val.sval) > 0;
-        return;
-    }
+static void int_neg(value_t *value, node_t *left, node_t *right) {
+    value->ival = left->val.ival * -1;
+}
 
-    handle_error(ERR_TYPE);
-    return;
+static void str_rev(value_t *value, node_t *left, node_t *right) {
+    strrev(value, &left->val);
 }
 
-/* equals() - Compares either two ints or two strings lexigraphically
- * and stores true in value if left is equal to right.
- */
-static void equals(value_t *value, node_t *left, node_t *right) {
-    if(left->type != right->type) {
-        handle_error(ERR_TYPE);
-        return;
-    }
+static void bool_not(value_t *value, node_t *left, node_t *right) {
+    value->bval = ! left->val.bval;
+}
 
-    if(left->type == INT_TYPE) {
-        value->bval = left->val.ival == right->val.ival;
-        return;
-    }
-    if(left->type == STRING_TYPE) {
-        value->bval = strcmp(left->val.sval, right->val.sval) == 0;
-        return;
-    }
+/* The array operators all go through array_binop() in array.c. */
+static void arr_add(value_t *value, node_t *left, node_t *right) {
+    array_binop(TOK_PLUS, value, left, right);
+}
 
-    handle_error(ERR_TYPE);
-    return;
+static void arr_sub(value_t *value, node_t *left, node_t *right) {
+    array_binop(TOK_BMINUS, value, left, right);
+}
+
+static void arr_mul(value_t *value, node_t *left, node_t *right) {
+    array_binop(TOK_TIMES, value, left, right);
+}
+
+static void arr_div(value_t *value, node_t *left, node_t *right) {
+    array_binop(TOK_DIV, value, left, right);
+}
+
+static void arr_mod(value_t *value, node_t *left, node_t *right) {
+    array_binop(TOK_MOD, value, left, right);
 }
 
+static void arr_lt(value_t *value, node_t *left, node_t *right) {
+    array_binop(TOK_LT, value, left, right);
+}
+
+static void arr_gt(value_t *value, node_t *left, node_t *right) {
+    array_binop(TOK_GT, value, left, right);
+}
+
+static void arr_eq(value_t *value, node_t *left, node_t *right) {
+    array_binop(TOK_EQ, value, left, right);
+}
+
+static void arr_neg(value_t *value, node_t *left, node_t *right) {
+    array_neg(value, left);
+}
 
 
 /* eval_node() - set the value of a non-root node based on the values of children
@@ -447,78 +407,55 @@ static void equals(value_t *value, node_t *left, node_t *right) {
 static void eval_node(node_t *nptr) {
     if(nptr == NULL) return;
     if(terminate || ignore_input) return;
+    // shared subtrees are evaluated once
+    if(nptr->flags & NODE_EVALUATED) return;
+    nptr->flags |= NODE_EVALUATED;
 
     if(nptr->node_type == NT_INTERNAL) {
         // Handle ternary operators
         if(nptr->tok == TOK_QUESTION) {
             if(nptr->children[0]->type != BOOL_TYPE){
-                handle_error(ERR_TYPE);
+                node_error(ERR_TYPE, nptr);
                 return;
             }
 
             eval_node(nptr->children[0]);
             node_t* result = nptr->children[0]->val.bval ? nptr->children[1] : nptr->children[2];
             eval_node(result);
+            if(terminate || ignore_input) return;
 
             if(nptr->type == INT_TYPE) {
                 nptr->val.ival = result->val.ival;
             } else if(nptr->type == BOOL_TYPE) {
                 nptr->val.bval = result->val.bval;
-            } else if(nptr->type == STRING_TYPE) {
-                char* string = result->val.sval;
-
-                nptr->val.sval = (char *) malloc(strlen(string) + 1);
-                if (! nptr->val.sval) {
-                    logging(LOG_FATAL, "failed to allocate string");
-                    return;
-                }
-                strcpy(nptr->val.sval, string);
+            } else {
+                copy_value(&nptr->val, &result->val, nptr->type);
             }
 
             return;
         }
 
+        if(nptr->tok == TOK_CALL) {
+            for(int i = 0; i < 3; i++) {
+                eval_node(nptr->children[i]);
+            }
+            if(terminate || ignore_input) return;
+            call_builtin(nptr);
+            return;
+        }
+
         for(int i = 0; i < 2; i++) {
             eval_node(nptr->children[i]);
         }
         
-        // Handle unary operators
-        if(is_unop(nptr->tok)) {
-            // _
-            if(nptr->tok == TOK_UMINUS) {
-                if(nptr->children[0]->type == INT_TYPE) {
-                    nptr->val.ival = nptr->children[0]->val.ival * -1;
-                } else if(nptr->children[0]->type == STRING_TYPE) {
-                    nptr->val.sval = strrev(nptr->children[0]->val.sval);
-                } else {
-                    handle_error(ERR_TYPE);
-                    return;
-                }
-                return;
-            }
-
-            // !
-            else if(nptr->tok == TOK_NOT) {
-                if(nptr->children[0]->type != BOOL_TYPE) {
-                    handle_error(ERR_TYPE);
-                    return;
-                }
-
-                nptr->val.bval = !nptr->children[0]->val.bval;
-                return;
-            }
-        }
-
-        // Handle binary operators
-        if(is_binop(nptr->tok)) {
+        // Handle unary and binary operators
+        if(nptr->op) {
             if(terminate || ignore_input) return;
-            
-            // Call the appropriate function based on the token
-            int index = nptr->tok - TOK_PLUS;
-            (*binopTypes[index].func_ptr)(&nptr->val, nptr->children[0], nptr->children[1]);
+
+            // Call the handler chosen by infer_type
+            (*handlers[nptr->op - 1].func_ptr)(&nptr->val, nptr->children[0], nptr->children[1]);
             return;
         }
-
     }
 
     return;
@@ -539,35 +476,64 @@ void eval_root(node_t *nptr) {
 
     // check for assignment
     if (nptr->type == ID_TYPE) {
-        eval_node(nptr->children[1]);
+        if (! jit_eval(nptr->children[1]))
+            eval_node(nptr->children[1]);
         if (terminate || ignore_input) return;
         
         if (nptr->children[0] == NULL) {
-            handle_error(ERR_SYNTAX);
+            node_error(ERR_SYNTAX, nptr);
             return;
         }
-        put(nptr->children[0]->val.sval, nptr->children[1]);
+        put(STR_VAL(nptr->children[0]->val), nptr->children[1]);
         return;
     }
 
-    for (int i = 0; i < 2; ++i) {
-        eval_node(nptr->children[i]);
-    }
+    if (! jit_eval(nptr->children[0]))
+        eval_node(nptr->children[0]);
+    eval_node(nptr->children[1]);
     if (terminate || ignore_input) return;
     
-    if (nptr->type == STRING_TYPE) {
-        (nptr->val).sval = (char *) malloc(strlen(nptr->children[0]->val.sval) + 1);
-        if (! nptr->val.sval) {
-            logging(LOG_FATAL, "failed to allocate string");
-            return;
-        }
-        strcpy(nptr->val.sval, nptr->children[0]->val.sval);
+    if (nptr->type == STRING_TYPE || nptr->type == ARRAY_TYPE) {
+        copy_value(&nptr->val, &nptr->children[0]->val, nptr->type);
     } else {
         nptr->val.ival = nptr->children[0]->val.ival;
     }
     return;
 }
 
+void infer_expr(node_t *nptr) {
+    infer_root(nptr);
+    return;
+}
+
+static void reset_node(node_t *nptr) {
+    if (nptr == NULL || ! (nptr->flags & NODE_EVALUATED)) return;
+    nptr->flags &= ~NODE_EVALUATED;
+    for (int i = 0; i < 3; i++) {
+        reset_node(nptr->children[i]);
+    }
+    if (nptr->node_type == NT_INTERNAL) {
+        free_value(&nptr->val, nptr->type);
+    }
+    return;
+}
+
+/* reset_eval() - undo eval_root so the tree can be evaluated again
+ * Parameter: A pointer to a root node, possibly NULL.
+ * Return value: None.
+ * Side effect: The values computed by operators are freed. Leaves keep the
+ * values they were given by parsing and type inference.
+ */
+
+void reset_eval(node_t *nptr) {
+    if (nptr == NULL) return;
+    for (int i = 0; i < 3; i++) {
+        reset_node(nptr->children[i]);
+    }
+    free_value(&nptr->val, nptr->type);
+    return;
+}
+
 /* infer_and_eval() - wrapper for calling infer() and eval() 
  * Parameter: A pointer to a root node.
  * Return value: none.
@@ -575,27 +541,36 @@ void eval_root(node_t *nptr) {
  */
 
 void infer_and_eval(node_t *nptr) {
+    perf_begin(PHASE_EVAL);
+    if (memo_lookup(nptr)) {
+        perf_end(PHASE_EVAL);
+        return;
+    }
+    unsigned long start = trace_start();
     infer_root(nptr);
+    trace_event("infer", start);
+    start = trace_start();
     eval_root(nptr);
+    trace_event("eval", start);
+    memo_store(nptr);
+    perf_end(PHASE_EVAL);
     return;
 }
 
 /* strrev() - helper function to reverse a given string 
- * Parameter: The string to reverse.
- * Return value: The reversed string. The input string is not modified.
+ * Parameter: The value to store the result in, and the string to reverse.
+ * Return value: None. The input string is not modified.
  * (STUDENT TODO)
  */
 
-char *strrev(char *str) {
-    int length = strlen(str);
+static void strrev(value_t *value, const value_t *str) {
+    int length = str_len(str);
+    const char *src = STR_VAL(*str);
 
-    char* result = malloc(length + 1);
+    char* result = alloc_str(value, length);
+    if (! result) return;
 
     for(int i = length - 1; i >= 0; i--) {
-        result[length - 1 - i] = str[i];
+        result[length - 1 - i] = src[i];
     }
-
-    result[length] = '\0';
-
-    return result;
 }
\ No newline at end of file
@@ -8,15 +8,43 @@
  **************************************************************************/ 
 
 #include "ci.h"
+#include <getopt.h>
 
 static char printbuf[100];
 
+/* Values returned by getopt_long for options that only have a long form. */
+enum {
+    OPT_TABLE = 256,
+    OPT_EXPR,
+    OPT_ERROR_LOG,
+    OPT_MEMO_STATS,
+    OPT_PERF_COUNTERS,
+    OPT_WATCH,
+    OPT_OUTPUT_FORMAT,
+    OPT_SHARED_VARS,
+    OPT_JOBS
+};
+
+static const struct option long_options[] = {
+    {"table", required_argument, NULL, OPT_TABLE},
+    {"expr",  required_argument, NULL, OPT_EXPR},
+    {"error-log", required_argument, NULL, OPT_ERROR_LOG},
+    {"memo-stats", no_argument, NULL, OPT_MEMO_STATS},
+    {"perf-counters", no_argument, NULL, OPT_PERF_COUNTERS},
+    {"watch", required_argument, NULL, OPT_WATCH},
+    {"output-format", required_argument, NULL, OPT_OUTPUT_FORMAT},
+    {"shared-vars", required_argument, NULL, OPT_SHARED_VARS},
+    {"jobs", required_argument, NULL, OPT_JOBS},
+    {NULL, 0, NULL, 0}
+};
+
 void handle_args(int argc, char **argv) {
     int option;
+    char *cache_dir = NULL;
     outfile = stdout;
     errfile = stderr;
 
-    while ((option = getopt(argc, argv, "i:o:")) != -1) {
+    while ((option = getopt_long(argc, argv, "i:o:c:j:m:PT:e:", long_options, NULL)) != -1) {
         switch(option) {
             case 'i':
                 if ((infile = fopen(optarg, "r")) == NULL) {
@@ -32,16 +60,109 @@ void handle_args(int argc, char **argv) {
                     return;
                 }
                 break;
+            case 'c':
+                cache_dir = optarg;
+                break;
+            case 'j':
+                jit_threshold = atoi(optarg);
+                break;
+            case 'm':
+                memo_slots = atoi(optarg);
+                break;
+            case 'P':
+                pipelined = true;
+                break;
+            case 'T':
+                trace_file = optarg;
+                break;
+            case 'e':
+                // there are fewer expressions than arguments
+                if (! eval_exprs && ! (eval_exprs = malloc(argc * sizeof(char *)))) {
+                    logging(LOG_FATAL, "failed to allocate expressions");
+                    return;
+                }
+                eval_exprs[num_eval_exprs++] = optarg;
+                break;
+            case OPT_TABLE:
+                table_file = optarg;
+                break;
+            case OPT_EXPR:
+                table_expr = optarg;
+                break;
+            case OPT_ERROR_LOG:
+                if (strcmp(optarg, "text") == 0) {
+                    err_log_format = ERRLOG_TEXT;
+                } else if (strcmp(optarg, "lines") == 0) {
+                    err_log_format = ERRLOG_LINES;
+                } else {
+                    sprintf(printbuf, "Ignoring unknown error log format %.40s", optarg);
+                    logging(LOG_INFO, printbuf);
+                }
+                break;
+            case OPT_MEMO_STATS:
+                memo_stats = true;
+                break;
+            case OPT_PERF_COUNTERS:
+                perf_counters = true;
+                break;
+            case OPT_WATCH:
+                watch_file = optarg;
+                break;
+            case OPT_OUTPUT_FORMAT:
+                if (strcmp(optarg, "text") == 0) {
+                    output_format = OUTPUT_TEXT;
+                } else if (strcmp(optarg, "ndjson") == 0) {
+                    output_format = OUTPUT_NDJSON;
+                } else if (strcmp(optarg, "binary") == 0) {
+                    output_format = OUTPUT_BINARY;
+                } else {
+                    sprintf(printbuf, "Ignoring unknown output format %.40s", optarg);
+                    logging(LOG_INFO, printbuf);
+                }
+                break;
+            case OPT_SHARED_VARS:
+                shared_vars = optarg;
+                break;
+            case OPT_JOBS:
+                if ((jobs = atoi(optarg)) <= 0) {
+                    sprintf(printbuf, "Ignoring invalid number of jobs %.40s", optarg);
+                    logging(LOG_INFO, printbuf);
+                    jobs = 0;
+                }
+                break;
             default:
                 sprintf(printbuf, "Ignoring unknown option %c", optopt);
                 logging(LOG_INFO, printbuf);
                 break;
         }
     }
+    if (jobs) { // the files to run
+        job_files = &argv[optind];
+        num_job_files = argc - optind;
+        optind = argc;
+    }
     for(; optind < argc; optind++) { // when some extra arguments are passed
         sprintf(printbuf, "Ignoring extra argument %s", argv[optind]);
         logging(LOG_INFO, printbuf);
     }
     if (infile == NULL) infile = stdin;
+    to_stdout = (outfile == stdout);
+    if (pipelined && cache_dir) {
+        logging(LOG_INFO, "script cache replays sequentially; ignoring -P");
+        pipelined = false;
+    }
+    if (jobs && (pipelined || cache_dir || memo_slots)) {
+        logging(LOG_INFO, "--jobs runs files independently; ignoring -P, -c and -m");
+        pipelined = false;
+        cache_dir = NULL;
+        memo_slots = 0;
+    }
+    if (output_format != OUTPUT_TEXT && (table_file || watch_file)) {
+        logging(LOG_INFO, "--table and --watch print text; ignoring --output-format");
+        output_format = OUTPUT_TEXT;
+    }
+    if (output_format != OUTPUT_TEXT) setvbuf(outfile, NULL, _IOFBF, OUTPUT_BUFSIZE);
+    shared_open();
+    cache_open(cache_dir, infile);
     return;
 }
@@ -27,7 +27,7 @@ static void print_init_msg(void) {
 void init(void) {
     if (! ci_prompt) ci_prompt = default_ci_prompt;
     init_table();
-    if (outfile != stdout) {
+    if (outfile != stdout || output_format != OUTPUT_TEXT) {
         ci_prompt = "";
         return;
     }
@@ -37,7 +37,13 @@ void init(void) {
 }
 
 void finalize(void) {
-    if (outfile != stdout) return;
+    flush_error_log();
+    cache_close();
+    jit_release();
+    memo_release();
+    trace_close();
+    perf_report();
+    if (outfile != stdout || output_format != OUTPUT_TEXT || eval_exprs || jobs) return;
     time_t t;
     assert(time(&t) != -1);
     delete_table();
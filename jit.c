@@ -0,0 +1,310 @@
+/**************************************************************************
+ * C S 429 EEL interpreter
+ *
+ * jit.c - Tiered native execution of integer/boolean expressions.
+ *
+ * Every line is parsed into a fresh AST, so hotness is tracked by the shape
+ * of an expression: its operators and the types of its leaves. Literal and
+ * variable values are not part of the shape; they are gathered from the
+ * leaves (already resolved by type inference) into an argument array, so a
+ * single compiled function serves every expression of that shape.
+ *
+ * A shape is interpreted by eval_node until it has been seen jit_threshold
+ * times, after which it is compiled to x86-64 code in an executable mapping.
+ * Compiled code has the signature
+ *
+ *     int fn(const int32_t *args, int32_t *result);
+ *
+ * and returns 0 on success or 1 on division by zero. The interpreter then
+ * evaluates the line again, so that the error is reported at the operand
+ * that caused it, as it would be without the JIT.
+ *
+ * Copyright (c) 2021. S. Chatterjee, X. Shen, T. Byrd. All rights reserved.
+ * May not be used, modified, or copied without permission.
+ **************************************************************************/
+
+#include "ci.h"
+#include <stdint.h>
+
+/* Number of evaluations before a shape is compiled. 0 disables the JIT. */
+int jit_threshold = 100;
+
+#if defined(__x86_64__)
+
+#include <stdarg.h>
+#include <sys/mman.h>
+
+#define JIT_CAPACITY 1024       // buckets in the shape table
+#define JIT_MAX_SHAPES 4096     // shapes tracked before new ones are ignored
+#define JIT_MAX_ARGS 64
+#define JIT_MAX_SHAPE 128
+#define JIT_CODE_SIZE 4096
+
+typedef int (*jit_fn_t)(const int32_t *args, int32_t *result);
+
+typedef struct shape {
+    char *key;              // encoded shape, see encode_shape()
+    unsigned long count;    // evaluations seen so far
+    bool failed;            // compilation was attempted and failed
+    jit_fn_t fn;            // compiled code, or NULL while interpreted
+    size_t code_size;       // size of the mapping holding fn
+    struct shape *next;
+} shape_t;
+
+/* Each thread running an interpreter (--jobs) has its own shapes and code. */
+static _Thread_local shape_t *shapes[JIT_CAPACITY];
+static _Thread_local int num_shapes = 0;
+
+/* Code buffer used while compiling a single shape. */
+static _Thread_local unsigned char code[JIT_CODE_SIZE];
+static _Thread_local int code_len;
+static _Thread_local bool code_overflow;
+static _Thread_local int err_patches[JIT_MAX_ARGS];
+static _Thread_local int num_err_patches;
+static _Thread_local int next_arg;
+
+/* encode_shape() - append the shape of a subtree to key, and the values of
+ * its leaves to args, both in preorder.
+ * Return value: false if the subtree cannot be compiled. */
+static bool encode_shape(node_t *nptr, char *key, int *klen, int32_t *args, int *nargs) {
+    if (! nptr) return false;
+    if (nptr->type != INT_TYPE && nptr->type != BOOL_TYPE) return false;
+    if (*klen + 2 >= JIT_MAX_SHAPE) return false;
+
+    if (nptr->node_type == NT_LEAF) {
+        if (*nargs >= JIT_MAX_ARGS) return false;
+        key[(*klen)++] = nptr->type == INT_TYPE ? 'i' : 'b';
+        args[(*nargs)++] = nptr->type == INT_TYPE ? nptr->val.ival : nptr->val.bval;
+        return true;
+    }
+
+    int arity;
+    switch (nptr->tok) {
+        case TOK_UMINUS:
+        case TOK_NOT:
+            arity = 1;
+            break;
+        case TOK_PLUS: case TOK_BMINUS: case TOK_TIMES: case TOK_DIV:
+        case TOK_MOD: case TOK_AND: case TOK_OR: case TOK_LT: case TOK_GT:
+        case TOK_EQ:
+            arity = 2;
+            break;
+        case TOK_QUESTION:
+            arity = 3;
+            break;
+        default:
+            return false;
+    }
+    key[(*klen)++] = 'A' + nptr->tok;
+    for (int i = 0; i < arity; i++)
+        if (! encode_shape(nptr->children[i], key, klen, args, nargs)) return false;
+    return true;
+}
+
+static void emit(int n, ...) {
+    va_list ap;
+    va_start(ap, n);
+    for (int i = 0; i < n; i++) {
+        int b = va_arg(ap, int);
+        if (code_len < JIT_CODE_SIZE) code[code_len++] = (unsigned char) b;
+        else code_overflow = true;
+    }
+    va_end(ap);
+}
+
+static void emit32(int32_t v) {
+    emit(4, v & 0xff, (v >> 8) & 0xff, (v >> 16) & 0xff, (v >> 24) & 0xff);
+}
+
+/* Emit a rel32 jump (opcode bytes given) and return the offset to patch. */
+static int emit_jump(int n, int op0, int op1) {
+    if (n == 1) emit(1, op0);
+    else emit(2, op0, op1);
+    emit32(0);
+    return code_len - 4;
+}
+
+static void patch(int at, int target) {
+    if (code_overflow) return;
+    int32_t rel = target - (at + 4);
+    memcpy(&code[at], &rel, sizeof(rel));
+}
+
+/* gen() - compile a shape, consuming it from *key. The value of the subtree
+ * is left in eax; intermediate values are kept on the machine stack. */
+static void gen(const char **key) {
+    char c = *(*key)++;
+    if (c == 'i' || c == 'b') {
+        emit(2, 0x8b, 0x87);                        // mov eax, [rdi + disp32]
+        emit32(4 * next_arg++);
+        return;
+    }
+
+    token_t tok = (token_t) (c - 'A');
+    if (tok == TOK_UMINUS || tok == TOK_NOT) {
+        gen(key);
+        if (tok == TOK_UMINUS) emit(2, 0xf7, 0xd8); // neg eax
+        else emit(3, 0x83, 0xf0, 0x01);             // xor eax, 1
+        return;
+    }
+    if (tok == TOK_QUESTION) {
+        gen(key);
+        emit(2, 0x85, 0xc0);                        // test eax, eax
+        int to_else = emit_jump(2, 0x0f, 0x84);     // jz else
+        gen(key);
+        int to_end = emit_jump(1, 0xe9, 0);         // jmp end
+        patch(to_else, code_len);
+        gen(key);
+        patch(to_end, code_len);
+        return;
+    }
+
+    gen(key);
+    emit(1, 0x50);                                  // push rax
+    gen(key);
+    emit(2, 0x89, 0xc1);                            // mov ecx, eax
+    emit(1, 0x58);                                  // pop rax
+    switch (tok) {
+        case TOK_PLUS:   emit(2, 0x01, 0xc8); break;        // add eax, ecx
+        case TOK_BMINUS: emit(2, 0x29, 0xc8); break;        // sub eax, ecx
+        case TOK_TIMES:  emit(3, 0x0f, 0xaf, 0xc1); break;  // imul eax, ecx
+        case TOK_AND:    emit(2, 0x21, 0xc8); break;        // and eax, ecx
+        case TOK_OR:     emit(2, 0x09, 0xc8); break;        // or eax, ecx
+        case TOK_DIV:
+        case TOK_MOD:
+            emit(2, 0x85, 0xc9);                            // test ecx, ecx
+            if (num_err_patches < JIT_MAX_ARGS)
+                err_patches[num_err_patches++] = emit_jump(2, 0x0f, 0x84);
+            else
+                code_overflow = true;
+            emit(1, 0x99);                                  // cdq
+            emit(2, 0xf7, 0xf9);                            // idiv ecx
+            if (tok == TOK_MOD) emit(2, 0x89, 0xd0);        // mov eax, edx
+            break;
+        case TOK_LT:
+        case TOK_GT:
+        case TOK_EQ:
+            emit(2, 0x39, 0xc8);                            // cmp eax, ecx
+            emit(3, 0x0f, tok == TOK_LT ? 0x9c : tok == TOK_GT ? 0x9f : 0x94, 0xc0);
+            emit(3, 0x0f, 0xb6, 0xc0);                      // movzx eax, al
+            break;
+        default:
+            code_overflow = true;
+            break;
+    }
+}
+
+/* compile() - translate a shape into an executable function.
+ * Return value: The function, or NULL if it could not be compiled. The size
+ * of its mapping is stored in *size. */
+static jit_fn_t compile(const char *key, size_t *size) {
+    code_len = 0;
+    code_overflow = false;
+    num_err_patches = 0;
+    next_arg = 0;
+
+    emit(1, 0x55);                                  // push rbp
+    emit(3, 0x48, 0x89, 0xe5);                      // mov rbp, rsp
+    gen(&key);
+    emit(2, 0x89, 0x06);                            // mov [rsi], eax
+    emit(2, 0x31, 0xc0);                            // xor eax, eax
+    emit(2, 0x5d, 0xc3);                            // pop rbp; ret
+
+    int err = code_len;
+    emit(3, 0x48, 0x89, 0xec);                      // mov rsp, rbp
+    emit(1, 0x5d);                                  // pop rbp
+    emit(1, 0xb8);                                  // mov eax, 1
+    emit32(1);
+    emit(1, 0xc3);                                  // ret
+    for (int i = 0; i < num_err_patches; i++)
+        patch(err_patches[i], err);
+    if (code_overflow) return NULL;
+
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    *size = (code_len + page - 1) / page * page;
+    void *mem = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) return NULL;
+    memcpy(mem, code, code_len);
+    if (mprotect(mem, *size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(mem, *size);
+        return NULL;
+    }
+    return (jit_fn_t) mem;
+}
+
+static unsigned long hash_shape(const char *key) {
+    unsigned long h = 5381;
+    while (*key) h = h * 33 + (unsigned char) *key++;
+    return h % JIT_CAPACITY;
+}
+
+static shape_t *find_shape(const char *key) {
+    unsigned long h = hash_shape(key);
+    for (shape_t *sp = shapes[h]; sp; sp = sp->next)
+        if (strcmp(sp->key, key) == 0) return sp;
+    if (num_shapes >= JIT_MAX_SHAPES) return NULL;
+
+    shape_t *sp = calloc(1, sizeof(shape_t));
+    if (! sp) return NULL;
+    sp->key = strdup(key);
+    if (! sp->key) {
+        free(sp);
+        return NULL;
+    }
+    sp->next = shapes[h];
+    shapes[h] = sp;
+    num_shapes++;
+    return sp;
+}
+
+bool jit_eval(node_t *nptr) {
+    if (jit_threshold <= 0 || ! nptr || nptr->node_type != NT_INTERNAL) return false;
+
+    char key[JIT_MAX_SHAPE];
+    int32_t args[JIT_MAX_ARGS];
+    int klen = 0, nargs = 0;
+    if (! encode_shape(nptr, key, &klen, args, &nargs)) return false;
+    key[klen] = '\0';
+
+    shape_t *sp = find_shape(key);
+    if (! sp || sp->failed) return false;
+    if (! sp->fn) {
+        if (++sp->count < (unsigned long) jit_threshold) return false;
+        if (! (sp->fn = compile(key, &sp->code_size))) {
+            sp->failed = true;
+            return false;
+        }
+    }
+
+    int32_t result;
+    // a trap has no position; eval_node finds the failing operand
+    if (sp->fn(args, &result) != 0) return false;
+    if (nptr->type == INT_TYPE) nptr->val.ival = result;
+    else nptr->val.bval = result != 0;
+    return true;
+}
+
+void jit_release(void) {
+    for (int i = 0; i < JIT_CAPACITY; i++) {
+        while (shapes[i]) {
+            shape_t *next = shapes[i]->next;
+            if (shapes[i]->fn) munmap((void *) shapes[i]->fn, shapes[i]->code_size);
+            free(shapes[i]->key);
+            free(shapes[i]);
+            shapes[i] = next;
+        }
+    }
+    num_shapes = 0;
+}
+
+#else
+
+bool jit_eval(node_t *nptr) {
+    return false;
+}
+
+void jit_release(void) {
+    return;
+}
+
+#endif
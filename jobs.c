@@ -0,0 +1,134 @@
+/**************************************************************************
+ * C S 429 EEL interpreter
+ *
+ * jobs.c - Run many independent scripts at once (--jobs N file...).
+ *
+ * Each file is run from start to finish by one of N worker threads, as if
+ * by "ci -i file -o file.out", with its own variable table. The state an
+ * interpreter keeps between lines (infile, outfile, the lexer, var_table,
+ * the JIT and the error log) is thread-local, so workers share nothing but
+ * the options.
+ *
+ * Files are handed out largest first from a shared counter, so a long file
+ * starts early and the short ones fill in around it.
+ *
+ * The script cache, memoization and the pipelined mode keep process-wide
+ * state and are turned off (see handle_args).
+ *
+ * Copyright (c) 2021. S. Chatterjee, X. Shen, T. Byrd. All rights reserved.
+ * May not be used, modified, or copied without permission.
+ **************************************************************************/
+
+#include "ci.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+
+int jobs = 0;
+char **job_files = NULL;
+int num_job_files = 0;
+
+/* A file to run, with its size for ordering. */
+typedef struct job {
+    char *path;
+    off_t size;
+} job_t;
+
+static job_t *queue;
+static atomic_int next_job;
+static atomic_bool failed;
+
+static int larger_first(const void *a, const void *b) {
+    off_t x = ((const job_t *) a)->size, y = ((const job_t *) b)->size;
+    return (x < y) - (x > y);
+}
+
+/* run_file() - run one script on the calling thread.
+ * Return value: false if its input or output could not be opened. */
+static bool run_file(const char *path) {
+    char printbuf[100];
+    size_t len = strlen(path);
+    char *out_path = malloc(len + sizeof(".out"));
+    if (! out_path) {
+        logging(LOG_FATAL, "failed to allocate job");
+        return false;
+    }
+    memcpy(out_path, path, len);
+    strcpy(out_path + len, ".out");
+
+    // the previous file on this thread may have ended with @q or an error
+    terminate = false;
+    ignore_input = false;
+    errfile = stderr;
+    infile = fopen(path, "r");
+    outfile = infile ? fopen(out_path, "w") : NULL;
+    free(out_path);
+    if (! outfile) {
+        if (infile) fclose(infile);
+        sprintf(printbuf, "failed to open %.40s or its output; skipping it", path);
+        logging(LOG_WARNING, printbuf);
+        return false;
+    }
+    if (output_format != OUTPUT_TEXT) setvbuf(outfile, NULL, _IOFBF, OUTPUT_BUFSIZE);
+
+    input_lineno = 0;
+    init_table();
+    while (! terminate) {
+        ignore_input = false;
+        input_lineno++;
+        node_t *nptr = read_and_parse();
+        infer_and_eval(nptr);
+        format_and_print(nptr);
+        cleanup(nptr);
+    }
+    flush_error_log();
+    delete_table();
+    fclose(infile);
+    fclose(outfile);
+    infile = NULL;
+    outfile = NULL;
+    return true;
+}
+
+static void *worker(void *arg) {
+    int i;
+    while ((i = atomic_fetch_add(&next_job, 1)) < num_job_files) {
+        if (! run_file(queue[i].path)) atomic_store(&failed, true);
+    }
+    jit_release();
+    perf_thread_exit();
+    return NULL;
+}
+
+int run_jobs(void) {
+    queue = malloc(num_job_files * sizeof(job_t));
+    pthread_t *threads = malloc(jobs * sizeof(pthread_t));
+    if (! queue || ! threads) {
+        free(queue);
+        free(threads);
+        logging(LOG_FATAL, "failed to allocate jobs");
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < num_job_files; i++) {
+        struct stat st;
+        queue[i].path = job_files[i];
+        queue[i].size = stat(job_files[i], &st) == 0 ? st.st_size : 0;
+    }
+    qsort(queue, num_job_files, sizeof(job_t), larger_first);
+    atomic_store(&next_job, 0);
+    atomic_store(&failed, false);
+    ci_prompt = "";
+    to_stdout = false;
+
+    int started;
+    for (started = 0; started < jobs && started < num_job_files; started++) {
+        if (pthread_create(&threads[started], NULL, worker, NULL) != 0) break;
+    }
+    // with no worker at all, run the files here
+    if (started == 0) worker(NULL);
+    for (int i = 0; i < started; i++) pthread_join(threads[i], NULL);
+
+    free(threads);
+    free(queue);
+    return atomic_load(&failed) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
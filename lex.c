@@ -10,20 +10,34 @@
 #include "ci.h"
 #include "ansicolors.h"
 
-FILE *infile = NULL;
-lptr_t this_token, next_token;
+_Thread_local FILE *infile = NULL;
+_Thread_local lptr_t this_token, next_token;
+_Thread_local line_status_t (*line_source)(char *) = read_input_line;
 
 extern void finalize(void);
 
-static char input_line[MAX_LINE_CHARS];
-static int lptr;
-static lexeme_t lex_array[2];
-static char printbuf[100];
+/* The lexer state is per thread so that the stages of the pipelined mode
+ * can each lex their own lines. */
+static _Thread_local char input_line[MAX_LINE_CHARS];
+static _Thread_local int lptr;
+static _Thread_local bool line_pending = false;
+static _Thread_local bool line_ok = false;
+static _Thread_local lexeme_t lex_array[2];
+static _Thread_local char printbuf[100];
+
+/* Lexer state set aside by push_lexer(). */
+static _Thread_local struct {
+    char input_line[MAX_LINE_CHARS];
+    int lptr;
+    bool line_ok;
+    lexeme_t lex_array[2];
+    lptr_t this_token, next_token;
+} saved;
 
 static const char CMD_START_CHAR = '@';
 static const char STRING_DELIMITER_CHAR = '\"';
 
-static const int NUM_SCTS = TOK_ASSIGN - TOK_LPAREN + 1;
+static const int NUM_SCTS = TOK_RBRACKET - TOK_LPAREN + 1;
 
 static const struct {
     char c;
@@ -47,9 +61,60 @@ static const struct {
     {'!', TOK_NOT},
     {'#', TOK_SEP},
     {'\n', TOK_EOL},
-    {'=', TOK_ASSIGN}
+    {'=', TOK_ASSIGN},
+    {',', TOK_COMMA},
+    {'[', TOK_LBRACKET},
+    {']', TOK_RBRACKET}
 };
 
+/* command_arg() - return the argument of a command such as "@save file"
+ * Parameter: The name of the command, without the leading '@'
+ * Return value: A copy of the argument, trimmed of surrounding whitespace, or
+ * NULL if the input does not spell out the command or has no argument. The
+ * input line itself is left intact for the script cache. */
+static char *command_arg(const char *name) {
+    static _Thread_local char arg_buf[MAX_LINE_CHARS];
+    size_t len = strlen(name);
+    if (strncmp(&input_line[lptr], name, len) != 0) return NULL;
+    char *arg = &input_line[lptr + len];
+    if (*arg != ' ' && *arg != '\t') return NULL;
+    while (*arg == ' ' || *arg == '\t') arg++;
+    arg = strcpy(arg_buf, arg);
+    char *end = arg + strlen(arg);
+    while (end > arg && isspace(end[-1])) *--end = '\0';
+    return *arg ? arg : NULL;
+}
+
+/* command_is() - check that the input spells out a command with no argument
+ * Parameter: The name of the command, without the leading '@'
+ * Return value: true if only whitespace follows the name. */
+static bool command_is(const char *name) {
+    size_t len = strlen(name);
+    if (strncmp(&input_line[lptr], name, len) != 0) return false;
+    for (char *rest = &input_line[lptr + len]; *rest; rest++)
+        if (! isspace(*rest)) return false;
+    return true;
+}
+
+/* print_names() - run "@p prefix" or "@p lo..hi", where either bound of a
+ * range may be left out.
+ * Return value: false if the argument is not a name or a range of names. */
+static bool print_names(char *arg) {
+    char *dots = strstr(arg, "..");
+    if (dots) *dots = '\0';
+    for (char *c = arg; *c; c++)
+        if (! isalnum(*c)) return false;
+    if (! dots) {
+        print_prefix(arg);
+        return true;
+    }
+    char *hi = dots + 2;
+    for (char *c = hi; *c; c++)
+        if (! isalnum(*c)) return false;
+    print_range(arg, *hi ? hi : NULL);
+    return true;
+}
+
 static token_t check_SCT(char c) {
     for (int i = 0; i < NUM_SCTS; i++)
         if (single_char_tokens[i].c == c) return single_char_tokens[i].t;
@@ -73,12 +138,59 @@ static void get_token(lptr_t lexp) {
             case 'q':
                 terminate = true;
                 break;
-            case 'p':
-                print_table();
+            case 'p': {
+                char *arg = command_arg("p");
+                if (arg && ! print_names(arg)) {
+                    handle_error_at(ERR_LEX, TOK_INVALID, lexp->startpos);
+                    break;
+                }
+                if (! arg) print_table();
+                ignore_input = true;
+                break;
+            }
+            case 's':
+                if (command_is("share")) {
+                    publish_table();
+                    ignore_input = true;
+                    break;
+                }
+                // fall through
+            case 'l': {
+                char *path = command_arg(c == 's' ? "save" : "load");
+                if (! path) {
+                    handle_error_at(ERR_LEX, TOK_INVALID, lexp->startpos);
+                    break;
+                }
+                if (c == 's') save_table(path);
+                else load_table(path);
+                ignore_input = true;
+                break;
+            }
+            case 'b': {
+                char *arg = command_arg("bench"), *expr = NULL;
+                long runs = arg ? strtol(arg, &expr, 10) : 0;
+                if (runs <= 0 || ! isspace(*expr)) {
+                    handle_error_at(ERR_LEX, TOK_INVALID, lexp->startpos);
+                    break;
+                }
+                run_bench(runs, expr);
+                ignore_input = true;
+                break;
+            }
+            case 'f':
+            case 'c':
+            case 'r':
+                if (! command_is(c == 'f' ? "fork" : c == 'c' ? "commit" : "rollback")) {
+                    handle_error_at(ERR_LEX, TOK_INVALID, lexp->startpos);
+                    break;
+                }
+                if (c == 'f') fork_table();
+                else if (c == 'c') commit_table();
+                else rollback_table();
                 ignore_input = true;
                 break;
             default:
-                handle_error(ERR_LEX);
+                handle_error_at(ERR_LEX, TOK_INVALID, lexp->startpos);
                 break;
         }
         return;
@@ -121,33 +233,101 @@ static void get_token(lptr_t lexp) {
         }
         while (c != '\0' && c != STRING_DELIMITER_CHAR) s[++i] = c = input_line[lptr++];
         if(c != STRING_DELIMITER_CHAR) {
-            handle_error(ERR_LEX);
+            handle_error_at(ERR_LEX, TOK_STR, lexp->startpos);
             return;
         }
         s[i] = '\0';
         return;
     }
 
-    handle_error(ERR_LEX);
+    handle_error_at(ERR_LEX, TOK_INVALID, lexp->startpos);
+}
+
+/* set_input_line() - make the next call to init_lexer() lex the given line
+ * instead of reading one from infile. Used to replay cached input lines.
+ * Parameter: A newline-terminated line of at most MAX_LINE_CHARS - 2 chars
+ * Return value: none */
+void set_input_line(const char *line) {
+    strncpy(input_line, line, sizeof(input_line) - 1);
+    input_line[sizeof(input_line) - 1] = '\0';
+    line_pending = true;
+}
+
+/* push_lexer() - set aside the line being lexed, so that a line nested in a
+ * command (see @bench) can be lexed, and make init_lexer() lex that line.
+ * pop_lexer() restores the line set aside. These do not nest.
+ * Parameter: A newline-terminated line of at most MAX_LINE_CHARS - 2 chars
+ * Return value: none */
+void push_lexer(const char *line) {
+    memcpy(saved.input_line, input_line, sizeof(input_line));
+    memcpy(saved.lex_array, lex_array, sizeof(lex_array));
+    saved.lptr = lptr;
+    saved.line_ok = line_ok;
+    saved.this_token = this_token;
+    saved.next_token = next_token;
+    set_input_line(line);
+}
+
+void pop_lexer(void) {
+    memcpy(input_line, saved.input_line, sizeof(input_line));
+    memcpy(lex_array, saved.lex_array, sizeof(lex_array));
+    lptr = saved.lptr;
+    line_ok = saved.line_ok;
+    this_token = saved.this_token;
+    next_token = saved.next_token;
+    line_pending = false;
+}
+
+/* lexer_line() - return the line most recently read by init_lexer()
+ * Parameter: none
+ * Return value: The line, or NULL if it was too long or had no newline */
+const char *lexer_line(void) {
+    return line_ok ? input_line : NULL;
+}
+
+/* read_input_line() - read the next line of infile
+ * Parameter: A buffer of MAX_LINE_CHARS characters
+ * Return value: The status of the line. The rest of an overlong line is
+ * consumed so the next read starts on the following line. */
+line_status_t read_input_line(char *line) {
+    if (fgets(line, MAX_LINE_CHARS, infile) == NULL) return LINE_EOF;
+    if (strchr(line, '\n') == NULL) {
+        if (strlen(line) >= MAX_LINE_CHARS - 1) {
+            int c;
+            while ((c = fgetc(infile)) != '\n' && c != EOF);
+            return LINE_TOO_LONG;
+        }
+        return LINE_NO_NEWLINE;
+    }
+    return LINE_OK;
 }
 
 void init_lexer(void) {
-    if (fgets(input_line, sizeof(input_line), infile) == NULL) {
-        logging(LOG_WARNING, "interpreter exited without @q");
-        terminate = true;
-        return;
+    line_status_t status;
+    line_ok = false;
+    if (line_pending) {
+        line_pending = false;
+        status = strchr(input_line, '\n') ? LINE_OK : LINE_NO_NEWLINE;
+    } else {
+        status = line_source(input_line);
     }
-    if (strchr(input_line, '\n') == NULL) {
-        if (strlen(input_line) >= MAX_LINE_CHARS - 1) {
+    switch (status) {
+        case LINE_EOF:
+            logging(LOG_WARNING, "interpreter exited without @q");
+            terminate = true;
+            return;
+        case LINE_TOO_LONG:
             sprintf(printbuf, "max input size is %d characters", MAX_LINE_CHARS - 2);
             logging(LOG_ERROR, printbuf);
-            while ((input_line[0] = fgetc(infile)) != '\n' && input_line[0] != EOF);
-        } else {
+            return;
+        case LINE_NO_NEWLINE:
             logging(LOG_ERROR, "expression ends without newline");
-        }
-        return;
+            return;
+        default:
+            break;
     }
 
+    line_ok = true;
     lptr = 0;
     this_token = lex_array;
     next_token = lex_array+1;
@@ -0,0 +1,191 @@
+/**************************************************************************
+ * C S 429 EEL interpreter
+ *
+ * memo.c - Memoization of expression results.
+ *
+ * Clients often re-run the same query while none of its variables change.
+ * Each expression line is encoded into a key made of its tokens, literal
+ * values and variable names. The result of a successful evaluation is kept
+ * with the version of every variable the expression read (see put() in
+ * variable.c), and later lines with the same key reuse the result as long as
+ * none of those versions changed.
+ *
+ * The memo is a direct-mapped table of memo_slots entries, so a new key
+ * simply replaces whatever was in its slot. Assignments, commands and lines
+ * that fail are never memoized.
+ *
+ * Copyright (c) 2021. S. Chatterjee, X. Shen, T. Byrd. All rights reserved.
+ * May not be used, modified, or copied without permission.
+ **************************************************************************/
+
+#include "ci.h"
+#include <stdint.h>
+
+#define MEMO_MAX_KEY 256
+#define MEMO_MAX_VARS 16
+
+/* Number of memo entries (-m N). Memoization is off by default, because
+ * encoding a line costs about as much as evaluating a short arithmetic one. */
+int memo_slots = 0;
+bool memo_stats = false;
+
+typedef struct memo {
+    char key[MEMO_MAX_KEY];         // encoded expression
+    int klen;                       // 0 if the entry is empty
+    type_t type;                    // type of the result
+    value_t val;                    // result; a heap string is owned here
+    int nvars;
+    short var_off[MEMO_MAX_VARS];   // offsets of variable names in key
+    unsigned long versions[MEMO_MAX_VARS];
+} memo_t;
+
+static memo_t *memos = NULL;
+static unsigned long hits, misses, evictions;
+
+/* The key of the line being evaluated, from memo_lookup() to memo_store(). */
+static _Thread_local char key[MEMO_MAX_KEY + sizeof(uint64_t)];
+static _Thread_local int klen;
+static _Thread_local short var_off[MEMO_MAX_VARS];
+static _Thread_local int nvars;
+static _Thread_local memo_t *slot;
+
+/* encode() - append the preorder encoding of an uninferred subtree to key.
+ * Return value: false if the expression cannot be memoized. */
+static bool encode(node_t *nptr) {
+    if (klen + 4 > MEMO_MAX_KEY) return false;
+    if (! nptr) {
+        key[klen++] = 0;
+        return true;
+    }
+    key[klen++] = (char) (nptr->tok + 2);
+    key[klen++] = (char) nptr->node_type;
+    key[klen++] = (char) (nptr->type + 1);
+    key[klen++] = (char) nptr->op;
+    if (nptr->node_type != NT_LEAF) {
+        for (int i = 0; i < 3; i++)
+            if (! encode(nptr->children[i])) return false;
+        return true;
+    }
+    if (nptr->type == STRING_TYPE || nptr->type == ID_TYPE) {
+        const char *s = STR_VAL(nptr->val);
+        size_t len = str_len(&nptr->val) + 1;
+        if (klen + len > MEMO_MAX_KEY) return false;
+        if (nptr->type == ID_TYPE) {
+            bool seen = false;
+            for (int i = 0; i < nvars && ! seen; i++)
+                seen = strcmp(key + var_off[i], s) == 0;
+            if (! seen) {
+                if (nvars == MEMO_MAX_VARS) return false;
+                var_off[nvars++] = klen;
+            }
+        }
+        memcpy(key + klen, s, len);
+        klen += len;
+        return true;
+    }
+    if (nptr->type == ARRAY_TYPE) {
+        const array_t *arr = nptr->val.aval;
+        size_t len = sizeof(arr->len) + arr->len * sizeof(int);
+        if (klen + len > MEMO_MAX_KEY) return false;
+        memcpy(key + klen, arr, len);
+        klen += len;
+        return true;
+    }
+    int32_t v = nptr->type == BOOL_TYPE ? nptr->val.bval
+              : nptr->type == FMT_TYPE ? nptr->val.fval : nptr->val.ival;
+    if (klen + sizeof(v) > MEMO_MAX_KEY) return false;
+    memcpy(key + klen, &v, sizeof(v));
+    klen += sizeof(v);
+    return true;
+}
+
+/* Hash the key a word at a time; keys are padded with zeros to a whole word. */
+static unsigned long hash_key(void) {
+    unsigned long h = klen;
+    memset(key + klen, 0, sizeof(uint64_t));
+    for (int i = 0; i < klen; i += sizeof(uint64_t)) {
+        uint64_t w;
+        memcpy(&w, key + i, sizeof(w));
+        h = (h ^ w) * 0x9e3779b97f4a7c15UL;
+        h ^= h >> 29;
+    }
+    return h;
+}
+
+/* memo_valid() - check that no variable read by a memo has changed since. */
+static bool memo_valid(memo_t *m) {
+    for (int i = 0; i < m->nvars; i++) {
+        entry_t *var = get(m->key + m->var_off[i]);
+        if (! var || var->version != m->versions[i]) return false;
+    }
+    return true;
+}
+
+bool memo_lookup(node_t *root) {
+    slot = NULL;
+    if (memo_slots <= 0 || ! root || root->type == ID_TYPE || ! root->children[0])
+        return false;
+    if (terminate || ignore_input) return false;
+    if (! memos && ! (memos = calloc(memo_slots, sizeof(memo_t)))) {
+        memo_slots = 0;
+        return false;
+    }
+
+    klen = nvars = 0;
+    if (! encode(root->children[0])) return false;
+    slot = &memos[hash_key() % memo_slots];
+
+    memo_t *m = slot;
+    if (m->klen == klen && memcmp(m->key, key, klen) == 0 && memo_valid(m)) {
+        hits++;
+        slot = NULL;
+        root->type = m->type;
+        if (m->type == STRING_TYPE && m->val.slen == SSO_HEAP) set_str(&root->val, m->val.sval);
+        else root->val = m->val;
+        return true;
+    }
+    misses++;
+    return false;
+}
+
+void memo_store(node_t *root) {
+    if (! slot || terminate || ignore_input) return;
+    if (root->type != INT_TYPE && root->type != BOOL_TYPE && root->type != STRING_TYPE) return;
+
+    memo_t *m = slot;
+    slot = NULL;
+    if (m->klen) {
+        if (m->klen != klen || memcmp(m->key, key, klen) != 0) evictions++;
+        if (m->type == STRING_TYPE) free_str(&m->val);
+        m->klen = 0;
+    }
+    for (int i = 0; i < nvars; i++) {
+        entry_t *var = get(key + var_off[i]);
+        if (! var) return;
+        m->versions[i] = var->version;
+        m->var_off[i] = var_off[i];
+    }
+    if (root->type == STRING_TYPE && root->val.slen == SSO_HEAP) {
+        if (! set_str(&m->val, root->val.sval)) return;
+    } else {
+        m->val = root->val;
+    }
+    memcpy(m->key, key, klen);
+    m->klen = klen;
+    m->type = root->type;
+    m->nvars = nvars;
+}
+
+void memo_release(void) {
+    if (memo_stats) {
+        unsigned long total = hits + misses;
+        fprintf(errfile, "memo: %lu lookups, %lu hits (%.1f%%), %lu evictions, %d slots\n",
+                total, hits, total ? 100.0 * hits / total : 0.0, evictions, memo_slots);
+    }
+    if (! memos) return;
+    for (int i = 0; i < memo_slots; i++) {
+        if (memos[i].klen && memos[i].type == STRING_TYPE) free_str(&memos[i].val);
+    }
+    free(memos);
+    memos = NULL;
+}
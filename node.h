@@ -15,12 +15,23 @@ typedef enum {
     NT_ROOT
 } node_type_t;
 
+/* Flags marking the work already done on a node. Identical subtrees of a
+ * line are shared (see share_subtrees() in parse.c), so a node may be reached
+ * more than once while inferring or evaluating its tree. */
+#define NODE_INFERRED 1
+#define NODE_EVALUATED 2
+
 /* The node struct. By using typedef, we create the shorthands node_t and nptr_t
  * for a variable's type. */
 typedef struct node {
-    token_t tok;                // represented input token
-    node_type_t node_type;      // node type
+    token_t tok : 8;            // represented input token
+    node_type_t node_type : 8;  // node type
+    type_t type : 8;            // data type defined in type.h
+    unsigned char op;           // operator handler chosen by type inference (eval.c),
+                                // or the function of a TOK_CALL set by the parser
+    short pos;                  // position of the token in the input line
+    unsigned char refs;         // parents beyond the first, for shared subtrees
+    unsigned char flags;        // NODE_INFERRED, NODE_EVALUATED
     value_t val;                // data value defined in value.h
-    type_t type;                // data type defined in type.h
     struct node *children[3];   // array of children nodes (3 is the maximum number of children)
 } node_t, *nptr_t;
@@ -0,0 +1,200 @@
+/**************************************************************************
+ * C S 429 EEL interpreter
+ *
+ * output.c - Results in formats meant for programs (--output-format).
+ *
+ * In the ndjson format each result is one JSON object on its own line:
+ *
+ *     {"type":"int","value":42}
+ *     {"type":"array","value":[1,2,3]}
+ *     {"type":"error","error":"EVAL"}
+ *
+ * Types are int, bool, string and array, and the error kinds are the tags of
+ * the machine-readable error log (LEX, SYNTAX, TYPE, EVAL, UNDEFINED), or
+ * OTHER for any other error that ends the line. Format specifiers are ignored.
+ *
+ * In the binary format each result is a one-byte tag, the length of the
+ * payload as a 32-bit little-endian integer, and the payload:
+ *
+ *     'i'  4 bytes, a little-endian int
+ *     'b'  1 byte, 0 or 1
+ *     's'  the bytes of the string, without a terminating NUL
+ *     'a'  4 bytes per element, little-endian ints
+ *     'e'  1 byte, the err_type_t of the error, or 0xff for OTHER
+ *
+ * Records are built in a buffer and written with a single fwrite, to an
+ * outfile given a large buffer by handle_args. No prompt or banner is printed,
+ * but commands such as @p still write their usual text.
+ *
+ * Copyright (c) 2021. S. Chatterjee, X. Shen, T. Byrd. All rights reserved.
+ * May not be used, modified, or copied without permission.
+ **************************************************************************/
+
+#include "ci.h"
+#include <endian.h>
+#include <stdint.h>
+
+output_fmt_t output_format = OUTPUT_TEXT;
+
+/* A record is assembled here; values that do not fit are written in pieces. */
+#define RECORD_SIZE 4096
+
+static _Thread_local char record[RECORD_SIZE];
+
+static char *put_int(char *p, int v) {
+    char digits[12];
+    int n = 0;
+    unsigned u = v < 0 ? -(unsigned) v : (unsigned) v;
+    if (v < 0) *p++ = '-';
+    do {
+        digits[n++] = '0' + u % 10;
+        u /= 10;
+    } while (u);
+    while (n) *p++ = digits[--n];
+    return p;
+}
+
+static char *put_str(char *p, const char *s) {
+    while (*s) *p++ = *s++;
+    return p;
+}
+
+/* Write the record up to p and start a new one. */
+static char *flush_record(char *p) {
+    fwrite(record, 1, p - record, outfile);
+    return record;
+}
+
+/* Append a JSON string literal, escaping what JSON requires. */
+static char *put_json_str(char *p, const char *s) {
+    static const char hex[] = "0123456789abcdef";
+    *p++ = '"';
+    for (; *s; s++) {
+        if (p > record + RECORD_SIZE - 8) p = flush_record(p);
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') {
+            *p++ = '\\';
+            *p++ = c;
+        } else if (c < 0x20) {
+            p = put_str(p, "\\u00");
+            *p++ = hex[c >> 4];
+            *p++ = hex[c & 0xf];
+        } else {
+            *p++ = c;
+        }
+    }
+    *p++ = '"';
+    return p;
+}
+
+static void print_json(node_t *nptr) {
+    char *p = record;
+    switch (nptr->type) {
+        case INT_TYPE:
+            p = put_str(p, "{\"type\":\"int\",\"value\":");
+            p = put_int(p, nptr->val.ival);
+            break;
+        case BOOL_TYPE:
+            p = put_str(p, "{\"type\":\"bool\",\"value\":");
+            p = put_str(p, nptr->val.bval ? "true" : "false");
+            break;
+        case STRING_TYPE:
+            p = put_str(p, "{\"type\":\"string\",\"value\":");
+            p = put_json_str(p, STR_VAL(nptr->val));
+            break;
+        case ARRAY_TYPE: {
+            const array_t *arr = nptr->val.aval;
+            p = put_str(p, "{\"type\":\"array\",\"value\":[");
+            for (int i = 0; i < arr->len; i++) {
+                if (p > record + RECORD_SIZE - 16) p = flush_record(p);
+                if (i > 0) *p++ = ',';
+                p = put_int(p, arr->elems[i]);
+            }
+            *p++ = ']';
+            break;
+        }
+        default:
+            return;
+    }
+    p = put_str(p, "}\n");
+    flush_record(p);
+}
+
+/* Append the tag and payload length that start a binary record. */
+static char *put_header(char *p, char tag, size_t len) {
+    uint32_t n = htole32((uint32_t) len);
+    *p++ = tag;
+    memcpy(p, &n, sizeof(n));
+    return p + sizeof(n);
+}
+
+static void print_binary(node_t *nptr) {
+    char *p = record;
+    switch (nptr->type) {
+        case INT_TYPE: {
+            uint32_t v = htole32((uint32_t) nptr->val.ival);
+            p = put_header(p, 'i', sizeof(v));
+            memcpy(p, &v, sizeof(v));
+            p += sizeof(v);
+            break;
+        }
+        case BOOL_TYPE:
+            p = put_header(p, 'b', 1);
+            *p++ = nptr->val.bval;
+            break;
+        case STRING_TYPE: {
+            size_t len = str_len(&nptr->val);
+            p = flush_record(put_header(p, 's', len));
+            fwrite(STR_VAL(nptr->val), 1, len, outfile);
+            return;
+        }
+        case ARRAY_TYPE: {
+            const array_t *arr = nptr->val.aval;
+            p = flush_record(put_header(p, 'a', arr->len * sizeof(int)));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            fwrite(arr->elems, sizeof(int), arr->len, outfile);
+#else
+            for (int i = 0; i < arr->len; i++) {
+                if (p > record + RECORD_SIZE - sizeof(uint32_t)) p = flush_record(p);
+                uint32_t v = htole32((uint32_t) arr->elems[i]);
+                memcpy(p, &v, sizeof(v));
+                p += sizeof(v);
+            }
+            flush_record(p);
+#endif
+            return;
+        }
+        default:
+            return;
+    }
+    flush_record(p);
+}
+
+void print_record(node_t *nptr) {
+    if (terminate || ignore_input) return;
+    if (nptr && nptr->type == ID_TYPE) nptr = nptr->children[1];
+    if (! nptr) {
+        logging(LOG_ERROR, "failed to print the node");
+        return;
+    }
+    if (nptr->type != INT_TYPE && nptr->type != BOOL_TYPE
+        && nptr->type != STRING_TYPE && nptr->type != ARRAY_TYPE) {
+        logging(LOG_ERROR, "unsupported data type for printing");
+        return;
+    }
+    if (output_format == OUTPUT_NDJSON) print_json(nptr);
+    else print_binary(nptr);
+}
+
+void print_error_record(err_type_t err, const char *tag) {
+    char *p = record;
+    if (output_format == OUTPUT_NDJSON) {
+        p = put_str(p, "{\"type\":\"error\",\"error\":\"");
+        p = put_str(p, tag);
+        p = put_str(p, "\"}\n");
+    } else {
+        p = put_header(p, 'e', 1);
+        *p++ = (char) err;
+    }
+    flush_record(p);
+}
@@ -0,0 +1,19 @@
+/**************************************************************************
+ * C S 429 EEL interpreter
+ *
+ * output.h - Formats in which results are written (--output-format).
+ *
+ * Copyright (c) 2021. S. Chatterjee, X. Shen, T. Byrd. All rights reserved.
+ * May not be used, modified, or copied without permission.
+ **************************************************************************/
+
+typedef enum {
+    OUTPUT_TEXT,    // "\tans = 5", for people (default)
+    OUTPUT_NDJSON,  // one JSON object per result
+    OUTPUT_BINARY   // length-prefixed records with a type tag
+} output_fmt_t;
+
+extern output_fmt_t output_format;
+
+/* Size of the buffer given to outfile for the ndjson and binary formats. */
+#define OUTPUT_BUFSIZE (1 << 20)
@@ -10,15 +10,26 @@
  **************************************************************************/ 
 
 #include "ci.h"
+#include <limits.h>
 
 /* Explained in ci.h */
-extern lptr_t this_token, next_token;
+extern _Thread_local lptr_t this_token, next_token;
 extern void init_lexer(void);
 extern void advance_lexer(void);
+extern void push_lexer(const char *line);
+extern void pop_lexer(void);
 
 /* Valid format specifers */
 static const char *VALID_FMTS = "dxXbB";
 
+/* Slots in the table used to find identical subtrees of one line. A line
+ * holds fewer than MAX_LINE_CHARS nodes, so this never fills up. */
+#define SHARE_SLOTS 128
+static _Thread_local node_t *share_table[SHARE_SLOTS];
+static _Thread_local unsigned char share_used[SHARE_SLOTS];    // filled slots
+static _Thread_local int num_shared;
+static _Thread_local int arm_depth;     // ternary arms share() is inside
+
 /* The only reserved identifiers are "true" and "false" */
 static const int NUM_RESERVED_IDS = 2;
 static const struct {
@@ -59,6 +70,13 @@ static token_t check_reserved_ids(char *s) {
     return TOK_INVALID;
 }
 
+/* syntax_error() - report a syntax error at the token that was not expected
+ * Parameter: none
+ * Return value: none */
+static void syntax_error(void) {
+    handle_error_at(ERR_SYNTAX, next_token->ttype, next_token->startpos);
+}
+
 /* build_leaf() - create a leaf node based on this_token and / or next_token
  * Parameter: none
  * Return value: pointer to a leaf node
@@ -67,6 +85,7 @@ static node_t *build_leaf(void) {
     node_t *result = calloc(1, sizeof(node_t));
     result->node_type = NT_LEAF;
     result->tok = this_token->ttype;
+    result->pos = this_token->startpos;
 
     switch(this_token->ttype) {
         case TOK_NUM:
@@ -87,25 +106,17 @@ static node_t *build_leaf(void) {
             break;
         case TOK_STR:
             result->type = STRING_TYPE;
-            result->val.sval = (char *) malloc(strlen(this_token->repr) + 1);
-            if (! result->val.sval) {
-                //TODO: Check for errors in memory allocation for all allocations
-                logging(LOG_FATAL, "failed to allocate string");
+            if (! set_str(&result->val, this_token->repr)) {
                 free(result);
                 return NULL;
             }
-            strcpy(result->val.sval, this_token->repr);
             break;
         case TOK_ID: ;
             result->type = ID_TYPE;
-            result->val.sval = (char *) malloc(strlen(this_token->repr) + 1);
-            if (! result->val.sval) {
-                //TODO: Check for errors in memory allocation for all allocations
-                logging(LOG_FATAL, "failed to allocate string");
+            if (! set_str(&result->val, this_token->repr)) {
                 free(result);
                 return NULL;
             }
-            strcpy(result->val.sval, this_token->repr);
             break;
         default:
             logging(LOG_ERROR, "Unrecognized token for building leaf node.");
@@ -115,6 +126,95 @@ static node_t *build_leaf(void) {
     return result;
 }
 
+static node_t *build_exp(void);
+
+/* build_array() - parse an array literal such as [1, _2, 3], with this_token
+ * at the opening bracket. The elements are integer literals, each of which
+ * may be negated with a leading _.
+ * Parameter: none
+ * Return value: pointer to a leaf node, or NULL after a syntax error */
+static node_t *build_array(void) {
+    int elems[MAX_LINE_CHARS];
+    int len = 0;
+    int pos = this_token->startpos;
+
+    while (next_token->ttype != TOK_RBRACKET) {
+        // a lexical error stops the tokens from advancing
+        if (terminate || ignore_input) return NULL;
+        // each element takes at least two characters of the line
+        if (len == MAX_LINE_CHARS) {
+            syntax_error();
+            return NULL;
+        }
+        if (len > 0) {
+            if (next_token->ttype != TOK_COMMA) {
+                syntax_error();
+                return NULL;
+            }
+            advance_lexer();
+        }
+        advance_lexer();
+        bool negate = this_token->ttype == TOK_UMINUS;
+        if (negate) advance_lexer();
+        if (this_token->ttype != TOK_NUM) {
+            handle_error_at(ERR_SYNTAX, this_token->ttype, this_token->startpos);
+            return NULL;
+        }
+        int v = (int) strtol(this_token->repr, NULL, 10);
+        elems[len++] = negate ? -v : v;
+    }
+    advance_lexer();
+
+    node_t *result = calloc(1, sizeof(node_t));
+    if (! result) {
+        logging(LOG_FATAL, "failed to allocate node");
+        return NULL;
+    }
+    result->node_type = NT_LEAF;
+    result->tok = TOK_LBRACKET;
+    result->pos = pos;
+    result->type = ARRAY_TYPE;
+    int *dst = alloc_array(&result->val, len);
+    if (! dst) {
+        free(result);
+        return NULL;
+    }
+    memcpy(dst, elems, len * sizeof(int));
+    return result;
+}
+
+/* build_call() - parse a call of a built-in function, such as len(s), with
+ * this_token at the function name
+ * Parameter: The index of the function
+ * Return value: pointer to an internal node, or NULL after a syntax error */
+static node_t *build_call(int fn) {
+    node_t *result = calloc(1, sizeof(node_t));
+    if (! result) {
+        logging(LOG_FATAL, "failed to allocate node");
+        return NULL;
+    }
+    result->node_type = NT_INTERNAL;
+    result->type = NO_TYPE;
+    result->tok = TOK_CALL;
+    result->pos = this_token->startpos;
+    result->op = fn + 1;
+    advance_lexer();
+
+    // this_token is the opening parenthesis, then each comma in turn
+    for (int n = 0; n < builtin_arity(fn); n++) {
+        advance_lexer();
+        result->children[n] = build_exp();
+        token_t end = n + 1 < builtin_arity(fn) ? TOK_COMMA : TOK_RPAREN;
+        if (terminate || ignore_input || next_token->ttype != end) {
+            syntax_error();
+            cleanup(result);
+            return NULL;
+        }
+        advance_lexer();
+    }
+    return result;
+}
+
 /* build_exp() - parse an expression based on this_token and / or next_token
  * Make calls to build_leaf() or build_exp() if necessary. 
  * Parameter: none
@@ -131,10 +231,15 @@ static node_t *build_exp(void) {
         return build_leaf();
     if (this_token->ttype == TOK_STR)
         return build_leaf();
+    if (this_token->ttype == TOK_LBRACKET)
+        return build_array();
     // handle the reserved identifiers, namely true and false
     if (this_token->ttype == TOK_ID) {
         if ((t = check_reserved_ids(this_token->repr)) != TOK_INVALID) {
             this_token->ttype = t;
+        } else if (next_token->ttype == TOK_LPAREN) {
+            int fn = find_builtin(this_token->repr);
+            if (fn >= 0) return build_call(fn);
         }
         return build_leaf();
     } else {
@@ -152,10 +257,11 @@ static node_t *build_exp(void) {
             // Handle unary operators
             if(is_unop(this_token->ttype)) {
                 result->tok = this_token->ttype;
+                result->pos = this_token->startpos;
                 advance_lexer();
                 result->children[0] = build_exp();
                 if(next_token->ttype != TOK_RPAREN) {
-                    handle_error(ERR_SYNTAX);
+                    syntax_error();
                     cleanup(result);
                     return NULL;
                 }
@@ -173,11 +279,12 @@ static node_t *build_exp(void) {
             result->children[0] = temp;
             if(is_binop(next_token->ttype)) {
                 result->tok = next_token->ttype;
+                result->pos = next_token->startpos;
                 advance_lexer();
                 advance_lexer();
                 result->children[1] = build_exp();
                 if(next_token->ttype != TOK_RPAREN) {
-                    handle_error(ERR_SYNTAX);
+                    syntax_error();
                     cleanup(result);
                     return NULL;
                 }
@@ -186,11 +293,12 @@ static node_t *build_exp(void) {
             } else if(next_token->ttype == TOK_QUESTION) {
                 // Handle Ternary
                 result->tok = next_token->ttype;
+                result->pos = next_token->startpos;
                 advance_lexer();
                 advance_lexer();
                 result->children[1] = build_exp();
                 if(next_token->ttype != TOK_COLON) {
-                    handle_error(ERR_SYNTAX);
+                    syntax_error();
                     cleanup(result);
                     return NULL;
                 }
@@ -198,7 +306,7 @@ static node_t *build_exp(void) {
                 advance_lexer();
                 result->children[2] = build_exp();
                 if(next_token->ttype != TOK_RPAREN) {
-                    handle_error(ERR_SYNTAX);
+                    syntax_error();
                     cleanup(result);
                     return NULL;
                 }
@@ -207,7 +315,7 @@ static node_t *build_exp(void) {
             }
         }
         
-        handle_error(ERR_SYNTAX);
+        syntax_error();
         free(result);
         return NULL;
     }
@@ -245,7 +353,7 @@ static node_t *build_root(void) {
         advance_lexer();
         ret->children[1] = build_exp();
         if (next_token->ttype != TOK_EOL) {
-            handle_error(ERR_SYNTAX);
+            syntax_error();
         }
         return ret;
     }
@@ -263,7 +371,7 @@ static node_t *build_root(void) {
         
         // check that our next token is a format specifier
         if (next_token->ttype != TOK_SEP) {
-            handle_error(ERR_SYNTAX);
+            syntax_error();
             return ret;
         }
 
@@ -271,7 +379,7 @@ static node_t *build_root(void) {
         
         // check that there is an ID following the format specifier
         if (next_token->ttype != TOK_ID) {
-            handle_error(ERR_SYNTAX);
+            syntax_error();
             return ret;
         }
 
@@ -279,7 +387,7 @@ static node_t *build_root(void) {
         if (id_is_fmt_spec(next_token->repr))
             next_token->ttype = TOK_FMT_SPEC;
         if (next_token->ttype != TOK_FMT_SPEC) {
-            handle_error(ERR_SYNTAX);
+            syntax_error();
             return ret;
         }
 
@@ -289,23 +397,150 @@ static node_t *build_root(void) {
         // if any tokens besides EOL remain, the syntax is not valid
         ret->children[1] = build_leaf();
         if (next_token->ttype != TOK_EOL) {
-            handle_error(ERR_SYNTAX);
+            syntax_error();
             return ret;
         }
         return ret;
     }
 
     // this return statement will only be reached if there was a syntax error
-    handle_error(ERR_SYNTAX);
+    syntax_error();
     return ret;
 }
 
+static unsigned long leaf_hash(node_t *nptr) {
+    unsigned long h = ((unsigned long) nptr->tok << 8) ^ (nptr->type & 0xff);
+    if (nptr->type == STRING_TYPE || nptr->type == ID_TYPE) {
+        for (const char *s = STR_VAL(nptr->val); *s; s++) h = h * 31 + (unsigned char) *s;
+    } else if (nptr->type == ARRAY_TYPE) {
+        const array_t *arr = nptr->val.aval;
+        for (int i = 0; i < arr->len; i++) h = h * 31 + (unsigned) arr->elems[i];
+    } else {
+        h = h * 31 + (unsigned) nptr->val.ival;
+    }
+    return h;
+}
+
+static bool same_leaf(node_t *a, node_t *b) {
+    if (a->tok != b->tok || a->type != b->type) return false;
+    switch (a->type) {
+        case STRING_TYPE:
+        case ID_TYPE:
+            return strcmp(STR_VAL(a->val), STR_VAL(b->val)) == 0;
+        case BOOL_TYPE:
+            return a->val.bval == b->val.bval;
+        case FMT_TYPE:
+            return a->val.fval == b->val.fval;
+        case ARRAY_TYPE:
+            return a->val.aval->len == b->val.aval->len
+                   && memcmp(a->val.aval->elems, b->val.aval->elems,
+                             a->val.aval->len * sizeof(int)) == 0;
+        default:
+            return a->val.ival == b->val.ival;
+    }
+}
+
+/* Leaves are cheap to evaluate, so only operator nodes are shared. Their
+ * children are compared by address if they are operators (which are already
+ * shared) and by value if they are leaves. */
+static unsigned long node_hash(node_t *nptr) {
+    unsigned long h = nptr->tok ^ (nptr->op << 8);
+    for (int i = 0; i < 3; i++) {
+        node_t *c = nptr->children[i];
+        h = h * 31 + (! c ? 0 : c->node_type == NT_LEAF ? leaf_hash(c)
+                      : (unsigned long) c / sizeof(node_t));
+    }
+    return h;
+}
+
+static bool same_node(node_t *a, node_t *b) {
+    if (a->tok != b->tok || a->op != b->op) return false;
+    for (int i = 0; i < 3; i++) {
+        node_t *x = a->children[i], *y = b->children[i];
+        if (x == y) continue;
+        if (! x || ! y || x->node_type != NT_LEAF || y->node_type != NT_LEAF
+            || ! same_leaf(x, y))
+            return false;
+    }
+    return true;
+}
+
+/* share() - replace each subtree identical to one seen earlier on this line
+ * with that earlier subtree. A subtree in an arm of a ternary is evaluated
+ * only if the arm is taken, so it may reuse a subtree seen outside any arm
+ * but is never reused itself; an error is then reported where it happened.
+ * Return value: The node to use in place of nptr. */
+static node_t *share(node_t *nptr) {
+    if (! nptr || nptr->node_type == NT_LEAF) return nptr;
+    for (int i = 0; i < 3; i++) {
+        bool arm = nptr->tok == TOK_QUESTION && i > 0;
+        arm_depth += arm;
+        nptr->children[i] = share(nptr->children[i]);
+        arm_depth -= arm;
+    }
+
+    unsigned long h = node_hash(nptr) % SHARE_SLOTS;
+    for (int n = 0; n < SHARE_SLOTS; n++, h = (h + 1) % SHARE_SLOTS) {
+        node_t *other = share_table[h];
+        if (! other) {
+            if (arm_depth > 0) return nptr;
+            share_table[h] = nptr;
+            share_used[num_shared++] = h;
+            return nptr;
+        }
+        if (same_node(other, nptr)) {
+            if (other->refs == UCHAR_MAX) return nptr;
+            other->refs++;
+            cleanup(nptr);
+            return other;
+        }
+    }
+    return nptr;
+}
+
+/* share_subtrees() - turn the expression of a root into a DAG in which
+ * identical subexpressions are a single node, so that each is inferred and
+ * evaluated once. Variables cannot change within a line, so identifiers are
+ * shared like literals. The assigned identifier and the format specifier are
+ * left alone. */
+static void share_subtrees(node_t *root) {
+    if (! root || terminate || ignore_input) return;
+    while (num_shared > 0) share_table[share_used[--num_shared]] = NULL;
+    int i = root->type == ID_TYPE ? 1 : 0;
+    root->children[i] = share(root->children[i]);
+}
+
 /* read_and_parse - return the root of an AST representing the current input
  * Parameter: none
  * Return value: the root of the AST */
 node_t *read_and_parse(void) {
+    node_t *nptr = NULL;
+    unsigned long start = trace_start();
+    perf_begin(PHASE_PARSE);
+    if (! cache_replay(&nptr)) {
+        init_lexer();
+        trace_event("lex", start);
+        start = trace_start();
+        nptr = build_root();
+        cache_record(nptr);
+    }
+    share_subtrees(nptr);
+    trace_event("parse", start);
+    perf_end(PHASE_PARSE);
+    return nptr;
+}
+
+/* parse_text() - parse a line given as text, such as the expression of a
+ * @bench command, leaving the line being lexed and the script cache alone
+ * Parameter: A newline-terminated line of at most MAX_LINE_CHARS - 2 chars
+ * Return value: the root of the AST */
+node_t *parse_text(const char *line) {
+    push_lexer(line);
     init_lexer();
-    return build_root();
+    node_t *nptr = build_root();
+    share_subtrees(nptr);
+    pop_lexer();
+    return nptr;
 }
 
 /* cleanup() - given the root of an AST, free all associated memory
@@ -316,11 +551,18 @@ void cleanup(node_t *nptr) {
     if(nptr == NULL) {
         return;
     }
+    // a shared node is freed by the last parent to let go of it
+    if(nptr->refs > 0) {
+        nptr->refs--;
+        return;
+    }
     for(int i = 0; i < 3; i++) {
         cleanup(nptr->children[i]);
     }
-    if(nptr->type == STRING_TYPE) {
-        free(nptr->val.sval);
+    if(nptr->type == ID_TYPE && nptr->node_type == NT_LEAF) {
+        free_str(&nptr->val);
+    } else {
+        free_value(&nptr->val, nptr->type);
     }
     free(nptr);
     return;
@@ -0,0 +1,156 @@
+/**************************************************************************
+ * C S 429 EEL interpreter
+ *
+ * perf.c - Hardware performance counters per interpreter phase
+ * (--perf-counters).
+ *
+ * Each thread that runs a phase opens a group of counters for itself with
+ * perf_event_open, counting user-space cycles, instructions, cache misses
+ * and branch misses. Where the hardware events are unavailable, as in many
+ * virtual machines, the software task clock and page fault counters are
+ * used instead. The group is read when a phase begins and ends, and the
+ * differences are added to the totals of the phase, which are reported on
+ * errfile at exit along with the average per line. Each thread closes its
+ * group with perf_thread_exit before it exits.
+ *
+ * Copyright (c) 2021. S. Chatterjee, X. Shen, T. Byrd. All rights reserved.
+ * May not be used, modified, or copied without permission.
+ **************************************************************************/
+
+#include "ci.h"
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#define PERF_MAX_COUNTERS 4
+
+bool perf_counters = false;
+
+typedef struct counter {
+    uint32_t type;
+    uint64_t config;
+    const char *name;
+} counter_t;
+
+static const counter_t hw_counters[] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "cache-misses"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "branch-misses"}
+};
+
+static const counter_t sw_counters[] = {
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, "task-clock-ns"},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, "page-faults"}
+};
+
+static const char *phase_names[NUM_PHASES] = {"parse", "eval", "print"};
+
+/* The counter set chosen by the first thread to open one; all threads use
+ * the same set so their counts can be added up. */
+static const counter_t *counters = NULL;
+static int num_counters = 0;
+static pthread_mutex_t perf_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t totals[NUM_PHASES][PERF_MAX_COUNTERS];
+static unsigned long lines[NUM_PHASES];
+
+static _Thread_local int group_fd = -2;     // -2 until opened, -1 if that failed
+static _Thread_local int group_fds[PERF_MAX_COUNTERS];     // leader first
+static _Thread_local uint64_t begin[NUM_PHASES][PERF_MAX_COUNTERS];
+static _Thread_local bool running[NUM_PHASES];
+
+/* open_group() - open a group of counters for the calling thread into
+ * group_fds.
+ * Return value: The file descriptor of the group leader, or -1. */
+static int open_group(const counter_t *set, int n) {
+    int *fds = group_fds;
+    for (int i = 0; i < n; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = set[i].type;
+        attr.size = sizeof(attr);
+        attr.config = set[i].config;
+        attr.disabled = i == 0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+        fds[i] = syscall(__NR_perf_event_open, &attr, 0, -1, i ? fds[0] : -1, 0);
+        if (fds[i] < 0) {
+            while (i-- > 0) close(fds[i]);
+            return -1;
+        }
+    }
+    ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    return fds[0];
+}
+
+static int thread_group(void) {
+    if (group_fd != -2) return group_fd;
+    pthread_mutex_lock(&perf_lock);
+    if (! counters) {
+        if ((group_fd = open_group(hw_counters, 4)) >= 0) {
+            counters = hw_counters;
+            num_counters = 4;
+        } else if ((group_fd = open_group(sw_counters, 2)) >= 0) {
+            counters = sw_counters;
+            num_counters = 2;
+        } else {
+            logging(LOG_INFO, "perf_event_open is unavailable; --perf-counters ignored");
+            perf_counters = false;
+        }
+    } else {
+        group_fd = open_group(counters, num_counters);
+    }
+    pthread_mutex_unlock(&perf_lock);
+    return group_fd;
+}
+
+static bool read_group(int fd, uint64_t *values) {
+    uint64_t buf[1 + PERF_MAX_COUNTERS];
+    ssize_t want = (1 + num_counters) * sizeof(uint64_t);
+    if (read(fd, buf, sizeof(buf)) < want || buf[0] != (uint64_t) num_counters) return false;
+    memcpy(values, buf + 1, num_counters * sizeof(uint64_t));
+    return true;
+}
+
+void perf_begin(phase_t phase) {
+    if (! perf_counters) return;
+    int fd = thread_group();
+    running[phase] = fd >= 0 && read_group(fd, begin[phase]);
+}
+
+void perf_end(phase_t phase) {
+    if (! perf_counters || ! running[phase]) return;
+    uint64_t end[PERF_MAX_COUNTERS];
+    running[phase] = false;
+    if (! read_group(group_fd, end)) return;
+    pthread_mutex_lock(&perf_lock);
+    for (int i = 0; i < num_counters; i++) totals[phase][i] += end[i] - begin[phase][i];
+    lines[phase]++;
+    pthread_mutex_unlock(&perf_lock);
+}
+
+void perf_report(void) {
+    if (! perf_counters || ! counters) return;
+    fprintf(errfile, "perf counters (%s):\n%-8s %10s", counters == hw_counters ? "hardware" : "software",
+            "phase", "lines");
+    for (int i = 0; i < num_counters; i++) fprintf(errfile, " %16s", counters[i].name);
+    fprintf(errfile, "\n");
+    for (int p = 0; p < NUM_PHASES; p++) {
+        fprintf(errfile, "%-8s %10lu", phase_names[p], lines[p]);
+        for (int i = 0; i < num_counters; i++) fprintf(errfile, " %16llu", (unsigned long long) totals[p][i]);
+        fprintf(errfile, "\n%-8s %10s", "", "per line");
+        for (int i = 0; i < num_counters; i++)
+            fprintf(errfile, " %16.1f", lines[p] ? (double) totals[p][i] / lines[p] : 0.0);
+        fprintf(errfile, "\n");
+    }
+    perf_thread_exit();
+}
+
+void perf_thread_exit(void) {
+    for (int i = 0; group_fd >= 0 && i < num_counters; i++) close(group_fds[i]);
+    group_fd = -2;
+}
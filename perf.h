@@ -0,0 +1,15 @@
+/**************************************************************************
+ * C S 429 EEL interpreter
+ *
+ * perf.h - Phases of the interpreter measured by --perf-counters.
+ *
+ * Copyright (c) 2021. S. Chatterjee, X. Shen, T. Byrd. All rights reserved.
+ * May not be used, modified, or copied without permission.
+ **************************************************************************/
+
+typedef enum {
+    PHASE_PARSE,        // read_and_parse
+    PHASE_EVAL,         // infer_and_eval
+    PHASE_PRINT,        // format_and_print
+    NUM_PHASES
+} phase_t;
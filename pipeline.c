@@ -0,0 +1,293 @@
+/**************************************************************************
+ * C S 429 EEL interpreter
+ *
+ * pipeline.c - Pipelined execution mode (-P).
+ *
+ * The top-level loop is split into four threads connected by bounded
+ * single-producer/single-consumer rings:
+ *
+ *     reader -> parser -> evaluator -> writer
+ *
+ * The reader splits infile into lines, the parser lexes and parses them,
+ * the evaluator runs infer_and_eval in input order (so variable updates are
+ * seen in the same order as in sequential mode) and the writer formats the
+ * results. Each line carries its own output buffers, which every stage
+ * writes to through its thread-local outfile/errfile, and the writer copies
+ * them out in input order, so output matches sequential mode exactly.
+ *
+ * Lines containing a command character are lexed by the evaluator instead of
+ * the parser, because commands such as @p and @load touch var_table while
+ * they are being lexed. Once a stage sees terminate it passes the line on
+ * and stops; lines already read or parsed beyond it are discarded.
+ *
+ * Copyright (c) 2021. S. Chatterjee, X. Shen, T. Byrd. All rights reserved.
+ * May not be used, modified, or copied without permission.
+ **************************************************************************/
+
+#include "ci.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+extern void set_input_line(const char *line);
+
+#define RING_SIZE 256
+
+bool pipelined = false;
+
+/* One line of input on its way through the pipeline. */
+typedef struct line_item {
+    char line[MAX_LINE_CHARS];
+    line_status_t status;
+    unsigned long lineno;   // input line number, counting from 1
+    bool deferred;          // lex and parse in the evaluator
+    bool ignore;            // ignore_input after the last stage that ran
+    bool terminate;         // terminate after the last stage that ran
+    node_t *root;
+    FILE *out_fp, *err_fp;  // per-line outfile/errfile
+    char *out_buf, *err_buf;
+    size_t out_len, err_len;
+} line_item_t;
+
+/* Lock-free bounded queue with one producer and one consumer. */
+typedef struct ring {
+    _Atomic size_t head;    // next slot to pop; written by the consumer
+    _Atomic size_t tail;    // next slot to push; written by the producer
+    line_item_t *slots[RING_SIZE];
+} ring_t;
+
+static ring_t to_parser, to_eval, to_writer;
+static ring_t recycled;     // written items handed back from writer to reader
+static atomic_bool stopping;
+static FILE *real_in, *real_out, *real_err;
+static table_t *real_table;
+
+/* The line the parser is currently working on, for pipeline_source(). */
+static _Thread_local line_item_t *current;
+
+/* Wait a little longer on each call, so idle stages do not hog a core. */
+static void backoff(int *spins) {
+    if (++(*spins) < 64) {
+        sched_yield();
+    } else {
+        struct timespec ts = {0, *spins < 1024 ? 20000 : 500000};
+        nanosleep(&ts, NULL);
+    }
+}
+
+/* Return value: false if the pipeline stopped before there was room. */
+static bool ring_push(ring_t *r, line_item_t *item) {
+    size_t t = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    int spins = 0;
+    while (t - atomic_load_explicit(&r->head, memory_order_acquire) == RING_SIZE) {
+        if (atomic_load(&stopping)) return false;
+        backoff(&spins);
+    }
+    r->slots[t % RING_SIZE] = item;
+    atomic_store_explicit(&r->tail, t + 1, memory_order_release);
+    return true;
+}
+
+/* Return value: The next item, or NULL if the pipeline stopped first. */
+static line_item_t *ring_pop(ring_t *r) {
+    size_t h = atomic_load_explicit(&r->head, memory_order_relaxed);
+    int spins = 0;
+    while (atomic_load_explicit(&r->tail, memory_order_acquire) == h) {
+        if (atomic_load(&stopping)) return NULL;
+        backoff(&spins);
+    }
+    line_item_t *item = r->slots[h % RING_SIZE];
+    atomic_store_explicit(&r->head, h + 1, memory_order_release);
+    return item;
+}
+
+static void free_item(line_item_t *item) {
+    if (! item) return;
+    if (item->out_fp) fclose(item->out_fp);
+    if (item->err_fp) fclose(item->err_fp);
+    free(item->out_buf);
+    free(item->err_buf);
+    cleanup(item->root);
+    free(item);
+}
+
+/* Point this thread's outfile, errfile and status flags at an item. */
+static void bind_item(line_item_t *item) {
+    outfile = item->out_fp;
+    errfile = item->err_fp;
+    ignore_input = item->ignore;
+    terminate = item->terminate;
+    input_lineno = item->lineno;
+}
+
+static void unbind_item(line_item_t *item) {
+    /* keep error records in line order by writing them with the line */
+    flush_error_log();
+    item->ignore = ignore_input;
+    item->terminate = terminate;
+}
+
+/* Take a written item back from the writer, or NULL if there is none. */
+static line_item_t *reuse_item(void) {
+    size_t h = atomic_load_explicit(&recycled.head, memory_order_relaxed);
+    if (atomic_load_explicit(&recycled.tail, memory_order_acquire) == h) return NULL;
+    line_item_t *item = recycled.slots[h % RING_SIZE];
+    atomic_store_explicit(&recycled.head, h + 1, memory_order_release);
+
+    /* a memstream's size is its position at the next flush */
+    rewind(item->out_fp);
+    rewind(item->err_fp);
+    item->deferred = item->ignore = item->terminate = false;
+    return item;
+}
+
+static void *reader_stage(void *arg) {
+    infile = real_in;
+    unsigned long lineno = 0;
+    bool done = false;
+    while (! done && ! atomic_load(&stopping)) {
+        line_item_t *item = reuse_item();
+        if (! item && (item = calloc(1, sizeof(line_item_t)))) {
+            item->out_fp = open_memstream(&item->out_buf, &item->out_len);
+            item->err_fp = open_memstream(&item->err_buf, &item->err_len);
+        }
+        if (! item || ! item->out_fp || ! item->err_fp) {
+            free_item(item);
+            atomic_store(&stopping, true);
+            break;
+        }
+        item->status = read_input_line(item->line);
+        item->lineno = ++lineno;
+        done = item->status == LINE_EOF;
+        if (atomic_load(&stopping) || ! ring_push(&to_parser, item)) free_item(item);
+    }
+    return NULL;
+}
+
+/* line_source used by init_lexer in the parser thread. */
+static line_status_t pipeline_source(char *line) {
+    memcpy(line, current->line, MAX_LINE_CHARS);
+    return current->status;
+}
+
+static void *parser_stage(void *arg) {
+    line_source = pipeline_source;
+    line_item_t *item;
+    while ((item = ring_pop(&to_parser))) {
+        bind_item(item);
+        if (item->status == LINE_OK && strchr(item->line, '@')) {
+            item->deferred = true;
+        } else {
+            current = item;
+            item->root = read_and_parse();
+        }
+        unbind_item(item);
+        bool last = terminate;
+        if (! ring_push(&to_eval, item)) {
+            free_item(item);
+            break;
+        }
+        if (last) break;
+    }
+    perf_thread_exit();
+    return NULL;
+}
+
+static void *eval_stage(void *arg) {
+    var_table = real_table;
+    line_item_t *item;
+    while ((item = ring_pop(&to_eval))) {
+        bind_item(item);
+        if (item->deferred) {
+            set_input_line(item->line);
+            item->root = read_and_parse();
+        }
+        infer_and_eval(item->root);
+        unbind_item(item);
+        bool last = terminate;
+        if (! ring_push(&to_writer, item)) {
+            free_item(item);
+            break;
+        }
+        if (last) break;
+    }
+    // the JIT and the counters keep state for this thread
+    jit_release();
+    perf_thread_exit();
+    return NULL;
+}
+
+static void *writer_stage(void *arg) {
+    outfile = real_out;
+    errfile = real_err;
+    line_item_t *item;
+    while ((item = ring_pop(&to_writer))) {
+        fflush(item->out_fp);
+        fflush(item->err_fp);
+        fwrite(item->out_buf, 1, item->out_len, real_out);
+        fwrite(item->err_buf, 1, item->err_len, real_err);
+        ignore_input = item->ignore;
+        terminate = item->terminate;
+        format_and_print(item->root);
+        cleanup(item->root);
+        item->root = NULL;
+        bool last = terminate;
+        /* hand the item back to the reader, unless it has fallen behind */
+        size_t t = atomic_load_explicit(&recycled.tail, memory_order_relaxed);
+        if (last || t - atomic_load_explicit(&recycled.head, memory_order_acquire) == RING_SIZE) {
+            free_item(item);
+        } else {
+            recycled.slots[t % RING_SIZE] = item;
+            atomic_store_explicit(&recycled.tail, t + 1, memory_order_release);
+        }
+        if (last) break;
+    }
+    /* the last line has been written; let the other stages wind down */
+    atomic_store(&stopping, true);
+    perf_thread_exit();
+    return NULL;
+}
+
+/* Free the items left in a ring whose consumer has exited. */
+static void drain(ring_t *r) {
+    size_t h = atomic_load(&r->head);
+    while (h != atomic_load(&r->tail)) {
+        free_item(r->slots[h % RING_SIZE]);
+        atomic_store(&r->head, ++h);
+    }
+}
+
+void run_pipeline(void) {
+    static void *(*const stages[])(void *) = {
+        writer_stage, eval_stage, parser_stage, reader_stage
+    };
+    pthread_t threads[4];
+    int started;
+
+    real_in = infile;
+    real_out = outfile;
+    real_err = errfile;
+    real_table = var_table;
+    atomic_store(&stopping, false);
+
+    for (started = 0; started < 4; started++) {
+        if (pthread_create(&threads[started], NULL, stages[started], NULL) != 0) {
+            atomic_store(&stopping, true);
+            logging(LOG_FATAL, "failed to start pipeline");
+            break;
+        }
+    }
+    /* the reader may be blocked reading a terminal after the last line, so
+     * it is never joined */
+    if (started == 4) pthread_detach(threads[3]);
+    for (int i = 0; i < started && i < 3; i++) pthread_join(threads[i], NULL);
+
+    drain(&to_writer);
+    drain(&to_eval);
+    if (started < 4) {
+        drain(&to_parser);
+        drain(&recycled);
+    }
+    terminate = true;
+    fflush(real_out);
+}
@@ -9,17 +9,31 @@
 
 #include "ci.h"
 
-FILE *outfile = NULL;
-FILE *errfile = NULL;
+_Thread_local FILE *outfile = NULL;
+_Thread_local FILE *errfile = NULL;
+bool to_stdout = true;
 char *ci_prompt = NULL;
 
-static char print_fmt;
-static bool printing_bool;
-static char fmt_string[100];
+static _Thread_local char print_fmt;
+static _Thread_local bool printing_bool;
+static _Thread_local char fmt_string[100];
 static char *lc_bool_print[] = {"false", "true"};
 static char *uc_bool_print[] = {"FALSE", "TRUE"};
 
-void format_and_print(node_t *nptr) {
+/* print_array() - print the elements of an array as [1, 2, 3], each in the
+ * integer format given by the conversion character fmt. */
+void print_array(const array_t *arr, char fmt) {
+    char elem_fmt[8];
+    sprintf(elem_fmt, "%%0#%c", fmt == 'b' || fmt == 'B' ? 'd' : fmt);
+    fputc('[', outfile);
+    for (int i = 0; i < arr->len; i++) {
+        if (i > 0) fputs(", ", outfile);
+        fprintf(outfile, elem_fmt, arr->elems[i]);
+    }
+    fputc(']', outfile);
+}
+
+static void print_root(node_t *nptr) {
     // check running status
     if (terminate) return;
     else if (ignore_input) {
@@ -62,10 +76,17 @@ void format_and_print(node_t *nptr) {
             break;
         case STRING_TYPE:
             sprintf(fmt_string, "\tans = \"%%s\"\n");
-            fprintf(outfile, fmt_string, nptr->val.sval);
+            fprintf(outfile, fmt_string, STR_VAL(nptr->val));
+            break;
+        case ARRAY_TYPE:
+            if (nptr->children[1] && nptr->children[1]->type == FMT_TYPE)
+                print_fmt = nptr->children[1]->val.fval;
+            fprintf(outfile, "\tans = ");
+            print_array(nptr->val.aval, print_fmt);
+            fprintf(outfile, "\n");
             break;
         case ID_TYPE:
-            format_and_print(nptr->children[1]);
+            print_root(nptr->children[1]);
             return;
         case FMT_TYPE:
         case NO_TYPE:
@@ -75,6 +96,15 @@ void format_and_print(node_t *nptr) {
     fprintf(outfile, "%s", ci_prompt);
 }
 
+void format_and_print(node_t *nptr) {
+    unsigned long start = trace_start();
+    perf_begin(PHASE_PRINT);
+    if (output_format == OUTPUT_TEXT) print_root(nptr);
+    else print_record(nptr);
+    perf_end(PHASE_PRINT);
+    trace_event("print", start);
+}
+
 #define MAX_PRINT_DEPTH 100
 int indents[MAX_PRINT_DEPTH];
 
@@ -123,7 +153,7 @@ void print_tree_helper(node_t* node, int level) {
         switch (node->tok) {
             case TOK_ID:
                 if (node->type == ID_TYPE)
-                    printf("id: %s", node->val.sval);
+                    printf("id: %s", STR_VAL(node->val));
                 else if(node->type == INT_TYPE)
                     printf("%d", node->val.ival);
                 else if(node->type == BOOL_TYPE && node->val.bval)
@@ -131,7 +161,7 @@ void print_tree_helper(node_t* node, int level) {
                 else if(node->type == BOOL_TYPE && !node->val.bval)
                     printf("false");
                 else if (node->type == STRING_TYPE)
-                    printf("\"%s\"", node->val.sval);
+                    printf("\"%s\"", STR_VAL(node->val));
                 else
                     printf("Invalide node type: %d", node->type);
                 break;
@@ -145,7 +175,10 @@ void print_tree_helper(node_t* node, int level) {
                 printf("false");
                 break;
             case TOK_STR:
-                printf("\"%s\"", node->val.sval);
+                printf("\"%s\"", STR_VAL(node->val));
+                break;
+            case TOK_LBRACKET:
+                printf("[%d elements]", node->val.aval->len);
                 break;
             case TOK_QUESTION:
                 printf("?");
@@ -198,6 +231,9 @@ void print_tree_helper(node_t* node, int level) {
             case TOK_FMT_SPEC:
                 printf("# %c", node->val.fval);
                 break;
+            case TOK_CALL:
+                printf("%s()", builtin_name(node->op - 1));
+                break;
             default:
                 printf("Invalid node token: %d", node->tok);
         }
@@ -0,0 +1,329 @@
+/**************************************************************************
+ * C S 429 EEL interpreter
+ *
+ * shared.c - Read-only variables shared between processes (--shared-vars).
+ *
+ * A process run with --shared-vars name publishes its table with @share as
+ * an image in the POSIX shared memory object /name. Every process run with
+ * the same name maps that image read-only at startup, and get() looks there
+ * for variables the process has not defined itself, so assigning a shared
+ * variable shadows it for this process only.
+ *
+ * The image is a header, an open-addressing hash table of record numbers,
+ * fixed-width records and a pool holding names, strings and arrays. Records
+ * refer to the pool by offset, so the image can be mapped at any address.
+ * Strings and arrays are used in place; arrays are kept with the layout of
+ * array_t. The image stays mapped until the process exits.
+ *
+ * Copyright (c) 2021. S. Chatterjee, X. Shen, T. Byrd. All rights reserved.
+ * May not be used, modified, or copied without permission.
+ **************************************************************************/
+
+#include "ci.h"
+#include <stdint.h>
+#include <pthread.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char SHARED_MAGIC[8] = "EELSHRD1";
+
+typedef struct shared_header {
+    char magic[8];          // SHARED_MAGIC, written last by @share
+    uint32_t count;         // number of records
+    uint32_t nslots;        // size of the hash table, a power of two
+    uint32_t pool_size;     // size of the pool in bytes
+    uint32_t pad;
+} shared_header_t;
+
+typedef struct shared_record {
+    uint32_t id_off;        // pool offset of the variable name
+    int32_t type;           // type_t of the value
+    int32_t val;            // ival / bval, or pool offset if STRING_TYPE
+                            // or ARRAY_TYPE
+} shared_record_t;
+
+/* get() hands out entries for shared variables from a small ring, since
+ * callers use an entry before looking up many others. */
+#define FOUND_RING 8
+
+char *shared_vars = NULL;
+
+static _Thread_local char printbuf[100];
+static _Thread_local char shm_name[MAX_LINE_CHARS + 2];
+static const shared_header_t *image = NULL;
+static const uint32_t *slots;
+static const shared_record_t *records;
+static const char *pool;
+static _Thread_local entry_t found[FOUND_RING];
+static _Thread_local int next_found;
+// the names in order, sorted when @p first lists them
+static char **sorted_names;
+static int num_sorted;
+static pthread_once_t sort_once = PTHREAD_ONCE_INIT;
+
+/* 32-bit FNV-1a hash of a variable name. */
+static uint32_t hash_name(const char *s) {
+    uint32_t h = 0x811c9dc5;
+    for (; *s; s++) {
+        h ^= (unsigned char) *s;
+        h *= 0x01000193;
+    }
+    return h;
+}
+
+/* set_shm_name() - form the name of the shared memory object.
+ * Return value: false, after logging, if --shared-vars is not a valid name. */
+static bool set_shm_name(log_lev_t sev) {
+    if (! *shared_vars || strchr(shared_vars, '/') || strlen(shared_vars) > MAX_LINE_CHARS) {
+        sprintf(printbuf, "invalid shared variables name %.40s", shared_vars);
+        logging(sev, printbuf);
+        return false;
+    }
+    sprintf(shm_name, "/%s", shared_vars);
+    return true;
+}
+
+/* Records and pool of an image being built by publish_table(). */
+typedef struct shared_builder {
+    shared_record_t *records;
+    size_t n;
+    char *pool;
+    size_t used, cap;
+    bool failed;
+} shared_builder_t;
+
+/* Append len bytes to the pool at a 4-byte boundary.
+ * Return value: The offset of the copy, or -1 on allocation failure. */
+static long pool_add(shared_builder_t *sb, const void *data, size_t len) {
+    size_t off = (sb->used + 3) & ~(size_t) 3;
+    while (off + len > sb->cap) {
+        size_t ncap = sb->cap ? sb->cap * 2 : 4096;
+        char *npool = realloc(sb->pool, ncap);
+        if (! npool) return -1;
+        sb->pool = npool;
+        sb->cap = ncap;
+    }
+    memset(sb->pool + sb->used, 0, off - sb->used);
+    memcpy(sb->pool + off, data, len);
+    sb->used = off + len;
+    return (long) off;
+}
+
+static void count_entry(entry_t *eptr, void *arg) {
+    (*(size_t *) arg)++;
+}
+
+static void add_entry(entry_t *eptr, void *arg) {
+    shared_builder_t *sb = arg;
+    if (sb->failed) return;
+    shared_record_t *rec = &sb->records[sb->n++];
+    long off = pool_add(sb, eptr->id, strlen(eptr->id) + 1);
+    rec->id_off = (uint32_t) off;
+    rec->type = eptr->type;
+    if (off >= 0 && eptr->type == STRING_TYPE) {
+        off = pool_add(sb, STR_VAL(eptr->val), str_len(&eptr->val) + 1);
+        rec->val = (int32_t) off;
+    } else if (off >= 0 && eptr->type == ARRAY_TYPE) {
+        const array_t *arr = eptr->val.aval;
+        off = pool_add(sb, arr, sizeof(array_t) + (size_t) arr->len * sizeof(int));
+        rec->val = (int32_t) off;
+    } else if (eptr->type == BOOL_TYPE) {
+        rec->val = eptr->val.bval;
+    } else {
+        rec->val = eptr->val.ival;
+    }
+    if (off < 0 || sb->used > INT32_MAX) sb->failed = true;
+}
+
+/* write_image() - lay the records out in a fresh shared memory object.
+ * Return value: false if it could not be created. */
+static bool write_image(shared_builder_t *sb) {
+    uint32_t nslots = 1;
+    while (nslots < 2 * sb->n) nslots *= 2;
+    size_t size = sizeof(shared_header_t) + nslots * sizeof(uint32_t)
+                + sb->n * sizeof(shared_record_t) + sb->used;
+
+    // processes that mapped the old image keep it; new ones get this one
+    shm_unlink(shm_name);
+    int fd = shm_open(shm_name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) return false;
+    char *base = MAP_FAILED;
+    if (ftruncate(fd, size) == 0)
+        base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        shm_unlink(shm_name);
+        return false;
+    }
+
+    shared_header_t *header = (shared_header_t *) base;
+    uint32_t *table = (uint32_t *) (base + sizeof(shared_header_t));
+    shared_record_t *recs = (shared_record_t *) (table + nslots);
+    header->count = (uint32_t) sb->n;
+    header->nslots = nslots;
+    header->pool_size = (uint32_t) sb->used;
+    memcpy(recs, sb->records, sb->n * sizeof(shared_record_t));
+    memcpy(recs + sb->n, sb->pool, sb->used);
+    for (uint32_t r = 0; r < sb->n; r++) {
+        uint32_t i = hash_name(sb->pool + recs[r].id_off) & (nslots - 1);
+        while (table[i]) i = (i + 1) & (nslots - 1);
+        table[i] = r + 1;
+    }
+    // a process starting meanwhile must not see a half-written image
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(header->magic, SHARED_MAGIC, sizeof(header->magic));
+    munmap(base, size);
+    return true;
+}
+
+void publish_table(void) {
+    if (! shared_vars) {
+        logging(LOG_ERROR, "@share needs --shared-vars");
+        return;
+    }
+    if (! var_table) {
+        logging(LOG_ERROR, "variable table doesn't exist");
+        return;
+    }
+    if (! set_shm_name(LOG_ERROR)) return;
+
+    size_t count = 0;
+    for_each_entry(count_entry, &count);
+    shared_builder_t sb = {0};
+    sb.records = calloc(count ? count : 1, sizeof(shared_record_t));
+    if (sb.records) for_each_entry(add_entry, &sb);
+    // the pool must end in a NUL for lookups to stay inside it
+    if (! sb.records || sb.failed || pool_add(&sb, "", 1) < 0) {
+        free(sb.records);
+        free(sb.pool);
+        logging(LOG_FATAL, "failed to allocate shared variables");
+        return;
+    }
+    if (! write_image(&sb)) {
+        sprintf(printbuf, "failed to publish shared variables %.40s", shared_vars);
+        logging(LOG_ERROR, printbuf);
+    }
+    free(sb.records);
+    free(sb.pool);
+    return;
+}
+
+void shared_open(void) {
+    if (! shared_vars || ! set_shm_name(LOG_INFO)) return;
+    int fd = shm_open(shm_name, O_RDONLY, 0);
+    if (fd < 0) {
+        if (errno == ENOENT) sprintf(printbuf, "shared variables %.40s not published yet", shared_vars);
+        else sprintf(printbuf, "failed to open shared variables %.40s", shared_vars);
+        logging(LOG_INFO, printbuf);
+        return;
+    }
+    struct stat st;
+    void *base = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t) sizeof(shared_header_t))
+        base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        sprintf(printbuf, "failed to map shared variables %.40s", shared_vars);
+        logging(LOG_INFO, printbuf);
+        return;
+    }
+
+    const shared_header_t *header = base;
+    size_t size = (size_t) st.st_size;
+    bool valid = memcmp(header->magic, SHARED_MAGIC, sizeof(header->magic)) == 0;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    valid = valid && header->nslots > header->count
+              && (header->nslots & (header->nslots - 1)) == 0
+              && size == sizeof(shared_header_t) + (size_t) header->nslots * sizeof(uint32_t)
+                         + (size_t) header->count * sizeof(shared_record_t) + header->pool_size
+              && header->pool_size > 0;
+    if (valid) {
+        slots = (const uint32_t *) (header + 1);
+        records = (const shared_record_t *) (slots + header->nslots);
+        pool = (const char *) (records + header->count);
+        valid = pool[header->pool_size - 1] == '\0';
+    }
+    if (! valid) {
+        munmap(base, size);
+        sprintf(printbuf, "invalid shared variables %.40s", shared_vars);
+        logging(LOG_INFO, printbuf);
+        return;
+    }
+    image = header;
+    return;
+}
+
+/* Check that a record only refers to the pool; the image is not trusted. */
+static bool record_valid(const shared_record_t *rec) {
+    uint32_t pool_size = image->pool_size;
+    if (rec->id_off >= pool_size) return false;
+    switch (rec->type) {
+        case INT_TYPE:
+        case BOOL_TYPE:
+            return true;
+        case STRING_TYPE:
+            return rec->val >= 0 && (uint32_t) rec->val < pool_size;
+        case ARRAY_TYPE: {
+            if (rec->val < 0 || rec->val % sizeof(int) != 0
+                || (size_t) rec->val + sizeof(array_t) > pool_size) return false;
+            const array_t *arr = (const array_t *) (pool + rec->val);
+            return arr->len >= 0
+                   && (size_t) arr->len <= (pool_size - rec->val - sizeof(array_t)) / sizeof(int);
+        }
+        default:
+            return false;
+    }
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+static void sort_names(void) {
+    sorted_names = malloc((image->count ? image->count : 1) * sizeof(char *));
+    if (! sorted_names) return;
+    for (uint32_t r = 0; r < image->count; r++) {
+        if (record_valid(&records[r])) sorted_names[num_sorted++] = (char *) pool + records[r].id_off;
+    }
+    qsort(sorted_names, num_sorted, sizeof(char *), compare_names);
+}
+
+int shared_names(char ***names) {
+    if (! image) return 0;
+    pthread_once(&sort_once, sort_names);
+    if (! sorted_names) logging(LOG_FATAL, "failed to allocate shared variable names");
+    *names = sorted_names;
+    return num_sorted;
+}
+
+entry_t *shared_get(char *id) {
+    if (! image) return NULL;
+    uint32_t mask = image->nslots - 1;
+    for (uint32_t i = hash_name(id) & mask; slots[i]; i = (i + 1) & mask) {
+        if (slots[i] > image->count) return NULL;
+        const shared_record_t *rec = &records[slots[i] - 1];
+        if (! record_valid(rec) || strcmp(pool + rec->id_off, id) != 0) continue;
+
+        entry_t *eptr = &found[next_found++ % FOUND_RING];
+        memset(eptr, 0, sizeof(entry_t));
+        eptr->id = (char *) pool + rec->id_off;
+        eptr->type = rec->type;
+        eptr->refs = 1;
+        if (rec->type == STRING_TYPE) {
+            eptr->val.sval = (char *) pool + rec->val;
+            eptr->val.slen = SSO_MAPPED;
+        } else if (rec->type == ARRAY_TYPE) {
+            eptr->val.aval = (array_t *) (pool + rec->val);
+        } else if (rec->type == BOOL_TYPE) {
+            eptr->val.bval = rec->val != 0;
+        } else {
+            eptr->val.ival = rec->val;
+        }
+        // version 0 is never given to a variable of the table
+        eptr->version = 0;
+        return eptr;
+    }
+    return NULL;
+}
@@ -0,0 +1,284 @@
+/**************************************************************************
+ * C S 429 EEL interpreter
+ *
+ * snapshot.c - Binary save and restore of the variable table (@save/@load).
+ *
+ * A snapshot image is laid out as a header, a block of fixed-width entry
+ * records and a pool of NUL-terminated strings. Records refer to their id
+ * and string value by offset into the pool, so a loaded image can be
+ * mapped read-only and its strings used in place by the table entries.
+ * Arrays are kept in the pool as decimal text and rebuilt on the heap when
+ * the image is loaded.
+ *
+ * Copyright (c) 2021. S. Chatterjee, X. Shen, T. Byrd. All rights reserved.
+ * May not be used, modified, or copied without permission.
+ **************************************************************************/
+
+#include "ci.h"
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char SNAP_MAGIC[8] = "EELSNAP1";
+
+typedef struct snap_header {
+    char magic[8];          // SNAP_MAGIC
+    uint32_t count;         // number of records
+    uint32_t pool_size;     // size of the string pool in bytes
+} snap_header_t;
+
+typedef struct snap_record {
+    uint32_t id_off;        // pool offset of the variable name
+    int32_t type;           // type_t of the value
+    int32_t val;            // ival / bval, or pool offset if STRING_TYPE
+                            // or ARRAY_TYPE
+} snap_record_t;
+
+/* Mapped images stay alive until the table referencing them is deleted. */
+typedef struct image {
+    void *base;
+    size_t size;
+    struct image *next;
+} image_t;
+
+static _Thread_local image_t *images = NULL;
+static _Thread_local char printbuf[100];
+
+/* Append a string to the pool, growing it as needed.
+ * Return value: The offset of the string, or -1 on allocation failure. */
+static long pool_add(char **pool, size_t *used, size_t *cap, char *s) {
+    size_t len = strlen(s) + 1;
+    while (*used + len > *cap) {
+        size_t ncap = *cap ? *cap * 2 : 1024;
+        char *npool = realloc(*pool, ncap);
+        if (! npool) return -1;
+        *pool = npool;
+        *cap = ncap;
+    }
+    memcpy(*pool + *used, s, len);
+    *used += len;
+    return (long) (*used - len);
+}
+
+/* Append an array to the pool as its elements in decimal, separated by
+ * single spaces.
+ * Return value: The offset of the text, or -1 on allocation failure. */
+static long pool_add_array(char **pool, size_t *used, size_t *cap, const array_t *arr) {
+    char *text = malloc((size_t) arr->len * 12 + 1), *p = text;
+    if (! text) return -1;
+    *p = '\0';
+    for (int i = 0; i < arr->len; i++) p += sprintf(p, i ? " %d" : "%d", arr->elems[i]);
+    long off = pool_add(pool, used, cap, text);
+    free(text);
+    return off;
+}
+
+/* State of save_table() while it walks the variable table. */
+typedef struct snap_builder {
+    snap_record_t *records;
+    size_t n;
+    char *pool;
+    size_t used, cap;
+    bool failed;
+} snap_builder_t;
+
+static void count_entry(entry_t *eptr, void *arg) {
+    (*(size_t *) arg)++;
+}
+
+static void add_entry(entry_t *eptr, void *arg) {
+    snap_builder_t *sb = arg;
+    if (sb->failed) return;
+    snap_record_t *rec = &sb->records[sb->n++];
+    long off = pool_add(&sb->pool, &sb->used, &sb->cap, eptr->id);
+    rec->id_off = (uint32_t) off;
+    rec->type = eptr->type;
+    if (off >= 0 && eptr->type == STRING_TYPE) {
+        off = pool_add(&sb->pool, &sb->used, &sb->cap, STR_VAL(eptr->val));
+        rec->val = (int32_t) off;
+    } else if (off >= 0 && eptr->type == ARRAY_TYPE) {
+        off = pool_add_array(&sb->pool, &sb->used, &sb->cap, eptr->val.aval);
+        rec->val = (int32_t) off;
+    } else if (eptr->type == BOOL_TYPE) {
+        rec->val = eptr->val.bval;
+    } else {
+        rec->val = eptr->val.ival;
+    }
+    if (off < 0 || sb->used > UINT32_MAX) sb->failed = true;
+}
+
+void save_table(char *path) {
+    if (! var_table) {
+        logging(LOG_ERROR, "variable table doesn't exist");
+        return;
+    }
+
+    size_t count = 0;
+    for_each_entry(count_entry, &count);
+
+    snap_builder_t sb = {0};
+    sb.records = calloc(count ? count : 1, sizeof(snap_record_t));
+    if (! sb.records) {
+        logging(LOG_FATAL, "failed to allocate snapshot");
+        return;
+    }
+    for_each_entry(add_entry, &sb);
+    if (sb.failed) {
+        free(sb.records);
+        free(sb.pool);
+        logging(LOG_FATAL, "failed to allocate snapshot");
+        return;
+    }
+    snap_record_t *records = sb.records;
+    char *pool = sb.pool;
+    size_t used = sb.used;
+
+    snap_header_t header;
+    memcpy(header.magic, SNAP_MAGIC, sizeof(header.magic));
+    header.count = (uint32_t) count;
+    header.pool_size = (uint32_t) used;
+
+    FILE *fp = fopen(path, "wb");
+    if (! fp) {
+        sprintf(printbuf, "failed to open snapshot file %.60s", path);
+        logging(LOG_ERROR, printbuf);
+    } else {
+        bool ok = fwrite(&header, sizeof(header), 1, fp) == 1
+               && fwrite(records, sizeof(snap_record_t), count, fp) == count
+               && fwrite(pool, 1, used, fp) == used;
+        if (fclose(fp) != 0 || ! ok) {
+            sprintf(printbuf, "failed to write snapshot file %.60s", path);
+            logging(LOG_ERROR, printbuf);
+        }
+    }
+    free(records);
+    free(pool);
+    return;
+}
+
+/* Check that every record of a mapped image is well formed before any of
+ * them is put into the table, so a corrupt file leaves the table unchanged. */
+static bool image_valid(char *base, size_t size) {
+    if (size < sizeof(snap_header_t)) return false;
+    snap_header_t *header = (snap_header_t *) base;
+    if (memcmp(header->magic, SNAP_MAGIC, sizeof(header->magic)) != 0) return false;
+
+    size_t rec_size = (size_t) header->count * sizeof(snap_record_t);
+    if (size != sizeof(snap_header_t) + rec_size + header->pool_size) return false;
+
+    snap_record_t *records = (snap_record_t *) (base + sizeof(snap_header_t));
+    char *pool = base + sizeof(snap_header_t) + rec_size;
+    if (header->pool_size > 0 && pool[header->pool_size - 1] != '\0') return false;
+
+    for (uint32_t i = 0; i < header->count; i++) {
+        if (records[i].id_off >= header->pool_size) return false;
+        if (! isalpha(pool[records[i].id_off])) return false;
+        switch (records[i].type) {
+            case INT_TYPE:
+            case BOOL_TYPE:
+                break;
+            case STRING_TYPE:
+                if (records[i].val < 0 || (uint32_t) records[i].val >= header->pool_size)
+                    return false;
+                break;
+            case ARRAY_TYPE: {
+                if (records[i].val < 0 || (uint32_t) records[i].val >= header->pool_size)
+                    return false;
+                char *text = pool + records[i].val;
+                if (strspn(text, "-0123456789 ") != strlen(text)) return false;
+                break;
+            }
+            default:
+                return false;
+        }
+    }
+    return true;
+}
+
+void load_table(char *path) {
+    if (! var_table) {
+        logging(LOG_ERROR, "variable table doesn't exist");
+        return;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        sprintf(printbuf, "snapshot file %.60s not found", path);
+        logging(LOG_ERROR, printbuf);
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(snap_header_t)) {
+        close(fd);
+        sprintf(printbuf, "invalid snapshot file %.60s", path);
+        logging(LOG_ERROR, printbuf);
+        return;
+    }
+    char *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        sprintf(printbuf, "failed to map snapshot file %.60s", path);
+        logging(LOG_ERROR, printbuf);
+        return;
+    }
+    if (! image_valid(base, st.st_size)) {
+        munmap(base, st.st_size);
+        sprintf(printbuf, "invalid snapshot file %.60s", path);
+        logging(LOG_ERROR, printbuf);
+        return;
+    }
+
+    image_t *img = malloc(sizeof(image_t));
+    if (! img) {
+        munmap(base, st.st_size);
+        logging(LOG_FATAL, "failed to allocate snapshot");
+        return;
+    }
+    img->base = base;
+    img->size = st.st_size;
+    img->next = images;
+    images = img;
+
+    snap_header_t *header = (snap_header_t *) base;
+    snap_record_t *records = (snap_record_t *) (base + sizeof(snap_header_t));
+    char *pool = base + sizeof(snap_header_t) + (size_t) header->count * sizeof(snap_record_t);
+    for (uint32_t i = 0; i < header->count; i++) {
+        value_t val = {0};
+        if (records[i].type == STRING_TYPE) {
+            /* short strings are copied inline; long ones stay in the image */
+            char *str = pool + records[i].val;
+            size_t len = strlen(str);
+            if (len <= SSO_CAPACITY) {
+                memcpy(val.sbuf, str, len + 1);
+                val.slen = (unsigned char) len;
+            } else {
+                val.sval = str;
+                val.slen = SSO_MAPPED;
+            }
+        } else if (records[i].type == ARRAY_TYPE) {
+            char *text = pool + records[i].val;
+            int len = *text ? 1 : 0;
+            for (char *p = text; *p; p++) len += *p == ' ';
+            int *elems = alloc_array(&val, len);
+            if (! elems) continue;
+            for (int j = 0; j < len; j++) elems[j] = (int) strtol(text, &text, 10);
+        } else if (records[i].type == BOOL_TYPE) {
+            val.bval = records[i].val != 0;
+        } else {
+            val.ival = records[i].val;
+        }
+        put_mapped(pool + records[i].id_off, records[i].type, val);
+    }
+    return;
+}
+
+void release_snapshots(void) {
+    while (images) {
+        image_t *next = images->next;
+        munmap(images->base, images->size);
+        free(images);
+        images = next;
+    }
+    return;
+}
@@ -0,0 +1,253 @@
+/**************************************************************************
+ * C S 429 EEL interpreter
+ *
+ * table.c - Evaluate one expression over every row of a delimited file
+ * (--table file --expr expression).
+ *
+ * The file is mapped into memory and its header row names the variables.
+ * Column types are inferred once from the first data row, the expression
+ * is parsed and compiled once against them, and the rows are then processed
+ * BATCH_ROWS at a time: only the columns the expression uses are extracted,
+ * and batch_run evaluates the whole chunk. Each input row is written to
+ * outfile with the result appended as a new column named "ans". Rows that
+ * cannot be evaluated get "ERROR" in that column.
+ *
+ * Copyright (c) 2021. S. Chatterjee, X. Shen, T. Byrd. All rights reserved.
+ * May not be used, modified, or copied without permission.
+ **************************************************************************/
+
+#include "ci.h"
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+extern void set_input_line(const char *line);
+
+char *table_file = NULL;
+char *table_expr = NULL;
+
+static char printbuf[100];
+static char *bool_print[] = {"false", "true"};
+
+/* A row of the mapped file, without its line terminator. */
+typedef struct row {
+    const char *start;
+    const char *end;
+} row_t;
+
+/* next_row() - find the row starting at *pos, advancing *pos past it.
+ * Return value: false at the end of the file. */
+static bool next_row(const char **pos, const char *limit, row_t *row) {
+    if (*pos >= limit) return false;
+    const char *nl = memchr(*pos, '\n', limit - *pos);
+    row->start = *pos;
+    row->end = nl ? nl : limit;
+    *pos = nl ? nl + 1 : limit;
+    if (row->end > row->start && row->end[-1] == '\r') row->end--;
+    return true;
+}
+
+/* next_field() - split the next field off a row.
+ * Return value: false if the row has no more fields. */
+static bool next_field(const char **pos, const row_t *row, char delim, row_t *field) {
+    if (*pos > row->end) return false;
+    const char *d = memchr(*pos, delim, row->end - *pos);
+    field->start = *pos;
+    field->end = d ? d : row->end;
+    *pos = d ? d + 1 : row->end + 1;
+    return true;
+}
+
+/* parse_field() - convert a field to a column value of the given type.
+ * Return value: false if the field does not hold a value of that type. */
+static bool parse_field(const row_t *f, type_t type, int32_t *out) {
+    size_t len = f->end - f->start;
+    if (type == BOOL_TYPE) {
+        if (len == 4 && memcmp(f->start, "true", 4) == 0) *out = 1;
+        else if (len == 5 && memcmp(f->start, "false", 5) == 0) *out = 0;
+        else return false;
+        return true;
+    }
+    const char *p = f->start;
+    bool neg = p < f->end && *p == '-';
+    if (neg) p++;
+    if (p == f->end) return false;
+    int64_t v = 0;
+    for (; p < f->end; p++) {
+        if (! isdigit((unsigned char) *p)) return false;
+        v = v * 10 + (*p - '0');
+        if (v > (int64_t) INT32_MAX + 1) return false;
+    }
+    if (neg) v = -v;
+    if (v > INT32_MAX || v < INT32_MIN) return false;
+    *out = (int32_t) v;
+    return true;
+}
+
+static type_t infer_field(const row_t *f) {
+    int32_t v;
+    if (parse_field(f, INT_TYPE, &v)) return INT_TYPE;
+    if (parse_field(f, BOOL_TYPE, &v)) return BOOL_TYPE;
+    return STRING_TYPE;
+}
+
+/* parse_expr() - parse the --expr argument with the regular lexer and parser.
+ * Return value: The root of the AST, or NULL after reporting an error. */
+static node_t *parse_expr(void) {
+    size_t len = strlen(table_expr);
+    if (len > MAX_LINE_CHARS - 2) {
+        sprintf(printbuf, "max input size is %d characters", MAX_LINE_CHARS - 2);
+        logging(LOG_ERROR, printbuf);
+        return NULL;
+    }
+    char line[MAX_LINE_CHARS];
+    sprintf(line, "%s\n", table_expr);
+    set_input_line(line);
+    node_t *root = read_and_parse();
+    if (root && ! ignore_input && (root->type == ID_TYPE || ! root->children[0]))
+        handle_error(ERR_SYNTAX);
+    if (ignore_input || terminate) {
+        cleanup(root);
+        return NULL;
+    }
+    return root;
+}
+
+int run_table(void) {
+    if (! table_expr) {
+        logging(LOG_FATAL, "--table requires --expr");
+        return EXIT_FAILURE;
+    }
+    int fd = open(table_file, O_RDONLY);
+    if (fd < 0) {
+        sprintf(printbuf, "table file %.60s not found", table_file);
+        logging(LOG_FATAL, printbuf);
+        return EXIT_FAILURE;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        sprintf(printbuf, "table file %.60s is empty", table_file);
+        logging(LOG_FATAL, printbuf);
+        return EXIT_FAILURE;
+    }
+    const char *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        sprintf(printbuf, "failed to map table file %.60s", table_file);
+        logging(LOG_FATAL, printbuf);
+        return EXIT_FAILURE;
+    }
+    madvise((void *) base, st.st_size, MADV_SEQUENTIAL);
+    const char *pos = base, *limit = base + st.st_size;
+
+    /* header row: column names and the delimiter */
+    row_t header, field;
+    next_row(&pos, limit, &header);
+    char delim = memchr(header.start, '\t', header.end - header.start) ? '\t' : ',';
+    int ncols = 0;
+    for (const char *p = header.start; next_field(&p, &header, delim, &field); ) ncols++;
+
+    char **names = calloc(ncols, sizeof(char *));
+    type_t *types = calloc(ncols, sizeof(type_t));
+    int32_t **cols = calloc(ncols, sizeof(int32_t *));
+    int32_t *out = malloc(BATCH_ROWS * sizeof(int32_t));
+    int32_t *err = malloc(BATCH_ROWS * sizeof(int32_t));
+    bool *bad = malloc(BATCH_ROWS * sizeof(bool));
+    row_t *rows = malloc(BATCH_ROWS * sizeof(row_t));
+    int status = EXIT_FAILURE;
+    if (! names || ! types || ! cols || ! out || ! err || ! bad || ! rows) {
+        logging(LOG_FATAL, "failed to allocate table buffers");
+        goto done;
+    }
+    int c = 0;
+    for (const char *p = header.start; next_field(&p, &header, delim, &field); c++) {
+        names[c] = strndup(field.start, field.end - field.start);
+        if (! names[c]) {
+            logging(LOG_FATAL, "failed to allocate table buffers");
+            goto done;
+        }
+    }
+
+    /* column types come from the first data row */
+    row_t first;
+    const char *peek = pos;
+    for (c = 0; c < ncols; c++) types[c] = STRING_TYPE;
+    if (next_row(&peek, limit, &first)) {
+        c = 0;
+        for (const char *p = first.start; c < ncols && next_field(&p, &first, delim, &field); c++)
+            types[c] = infer_field(&field);
+    }
+
+    node_t *root = parse_expr();
+    batch_prog_t *prog = root ? batch_compile(root->children[0], names, types, ncols) : NULL;
+    cleanup(root);
+    if (! prog) goto done;
+
+    /* only the columns the program reads are extracted */
+    bool *used = calloc(ncols, sizeof(bool));
+    if (! used) {
+        batch_free(prog);
+        logging(LOG_FATAL, "failed to allocate table buffers");
+        goto done;
+    }
+    for (int k = 0; k < prog->nops; k++)
+        if (prog->ops[k].tok == TOK_ID) used[prog->ops[k].arg] = true;
+    for (c = 0; c < ncols; c++) {
+        if (used[c] && ! (cols[c] = malloc(BATCH_ROWS * sizeof(int32_t)))) {
+            free(used);
+            batch_free(prog);
+            logging(LOG_FATAL, "failed to allocate table buffers");
+            goto done;
+        }
+    }
+
+    setvbuf(outfile, NULL, _IOFBF, 1 << 16);
+    fprintf(outfile, "%.*s%cans\n", (int) (header.end - header.start), header.start, delim);
+    int n;
+    do {
+        for (n = 0; n < BATCH_ROWS && next_row(&pos, limit, &rows[n]); n++) {
+            if (rows[n].start == rows[n].end) {
+                n--;
+                continue;
+            }
+            bad[n] = false;
+            c = 0;
+            for (const char *p = rows[n].start; next_field(&p, &rows[n], delim, &field); c++) {
+                if (c < ncols && used[c] && ! parse_field(&field, types[c], &cols[c][n]))
+                    bad[n] = true;
+            }
+            if (c != ncols) bad[n] = true;
+            /* keep unparsable rows from tripping the kernels */
+            if (bad[n])
+                for (int k = 0; k < ncols; k++)
+                    if (used[k]) cols[k][n] = 1;
+        }
+        batch_run(prog, cols, n, out, err);
+        for (int i = 0; i < n; i++) {
+            fprintf(outfile, "%.*s%c", (int) (rows[i].end - rows[i].start), rows[i].start, delim);
+            if (bad[i] || err[i]) fputs("ERROR\n", outfile);
+            else if (prog->type == BOOL_TYPE) fprintf(outfile, "%s\n", bool_print[out[i] != 0]);
+            else fprintf(outfile, "%d\n", out[i]);
+        }
+    } while (n == BATCH_ROWS && ! terminate);
+    status = terminate ? EXIT_FAILURE : EXIT_SUCCESS;
+    free(used);
+    batch_free(prog);
+
+done:
+    for (c = 0; c < ncols; c++) {
+        if (names) free(names[c]);
+        if (cols) free(cols[c]);
+    }
+    free(names);
+    free(types);
+    free(cols);
+    free(out);
+    free(err);
+    free(bad);
+    free(rows);
+    munmap((void *) base, st.st_size);
+    return status;
+}
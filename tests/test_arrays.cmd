@@ -0,0 +1,2 @@
+# [1,$] used to hang the parser
+timeout 10 ./ci -i $TESTFILE -o _output1
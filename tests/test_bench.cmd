@@ -0,0 +1,3 @@
+# the times vary from run to run
+./ci -i $TESTFILE -o _bench
+sed -E 's/[0-9]+ ns/N ns/g' _bench > _output1 && rm -f _bench
@@ -0,0 +1,7 @@
+rm -rf /tmp/ci_test_cache && mkdir /tmp/ci_test_cache
+./ci -c /tmp/ci_test_cache -i $TESTFILE -o _output0
+[ -n "$(ls /tmp/ci_test_cache)" ] || echo "no cache image written" >&2
+# the second run replays the parsed script from the cache
+./ci -c /tmp/ci_test_cache -i $TESTFILE -o _output1
+cmp -s _output0 _output1 || echo "output differs when replayed" >&2
+rm -f _output0
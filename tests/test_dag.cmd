@@ -0,0 +1 @@
+./ci --error-log=lines -i $TESTFILE -o _output1
@@ -0,0 +1,2 @@
+./ci --error-log=lines -i $TESTFILE -o _output1
+./ci --error-log=text -i $TESTFILE -o /dev/null
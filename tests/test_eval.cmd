@@ -0,0 +1,13 @@
+# each line of the script is passed with -e
+./ci -o _output1 -e "$(sed -n 1p $TESTFILE)" -e "$(sed -n 2p $TESTFILE)" -e "$(sed -n 3p $TESTFILE)" \
+    -e "$(sed -n 4p $TESTFILE)" -e "$(sed -n 5p $TESTFILE)" -e "$(sed -n 6p $TESTFILE)"
+echo "exit status $?" >&2
+# the status tells success, the kind of the first error, or a failure
+./ci -o /dev/null -e '(1 + 1)'
+echo "exit status $?" >&2
+./ci -o /dev/null -e 'undefined' -e '(1 + 1)'
+echo "exit status $?" >&2
+./ci -o /dev/null -e '(1 + $)'
+echo "exit status $?" >&2
+./ci -o /dev/null -e "($(printf '1 + %.0s' $(seq 40))1)"
+echo "exit status $?" >&2
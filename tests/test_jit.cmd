@@ -0,0 +1 @@
+./ci -j 2 --error-log=lines -i $TESTFILE -o _output1
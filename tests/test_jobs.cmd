@@ -0,0 +1,6 @@
+# the other scripts run alongside define variables this one must not see
+./ci --jobs 3 $TESTFILE tests/test_names.txt tests/test_arrays.txt tests/test_builtins.txt tests/test_no_such_script.txt
+echo "exit status $?" >&2
+for t in names arrays builtins; do
+    cmp -s tests/test_$t.txt.out tests/test_$t.expected || echo "test_$t differs under --jobs" >&2
+done
@@ -0,0 +1 @@
+./ci -m 64 --memo-stats -i $TESTFILE -o _output1
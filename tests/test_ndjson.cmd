@@ -0,0 +1 @@
+./ci --output-format=ndjson -i $TESTFILE -o _output1
@@ -0,0 +1,4 @@
+# the counts vary from run to run, but the number of lines in each phase does not;
+# -P runs each phase on its own thread, which must close its counters on exit,
+# and its parser reads ahead one line past @q
+./ci --perf-counters -i $TESTFILE -o _output1 2> _perf && ./ci --perf-counters -P -i $TESTFILE -o _output0 2>> _perf && cat _output0 >> _output1 && sed -E 's/^([a-z]+ +[0-9]+).*/\1 N/; s/(per line).*/\1 N/' _perf >> _output1; rm -f _perf _output0
@@ -0,0 +1,6 @@
+./ci -P -i $TESTFILE -o _output1
+# the results and the log must match sequential mode
+./ci -i $TESTFILE -o _output0 2> _errors0
+./ci -P -i $TESTFILE -o _output2 2> _errors2
+cmp -s _output0 _output2 && cmp -s _errors0 _errors2 || echo "-P differs from sequential mode" >&2
+rm -f _output0 _output2 _errors0 _errors2
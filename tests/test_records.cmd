@@ -0,0 +1,3 @@
+# the records are shown in hex, one byte per column
+./ci --output-format=binary -i $TESTFILE -o _records
+od -An -v -tx1 _records > _output1 && rm -f _records
@@ -0,0 +1,7 @@
+rm -f /dev/shm/ci_test_shared
+# one process publishes the variables the test reads
+./ci --shared-vars ci_test_shared -o /dev/null -e 'base = 41' -e 'greeting = "hello, shared memory"' -e 'list = [1, 2, 3]' -e 'flag = false' -e '@share'
+./ci --shared-vars ci_test_shared -i $TESTFILE -o _output1
+# @share without --shared-vars is an error
+./ci -e '@share' -o /dev/null
+rm -f /dev/shm/ci_test_shared
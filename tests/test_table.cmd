@@ -0,0 +1,3 @@
+./ci --table $TESTFILE --expr '((price * qty) > 50)' -o _output1
+./ci --table $TESTFILE --expr '((qty > 5) ? (price / qty) : (_1))' -o _output0
+cat _output0 >> _output1 && rm -f _output0
@@ -0,0 +1,6 @@
+# two full 8-row blocks and a tail, with zero divisors and a bad value inside the blocks
+./ci --table $TESTFILE --expr '((price / qty) > 2)' -o _output1
+./ci --table $TESTFILE --expr '((qty > 5) ? (price / qty) : (_1))' -o _output0
+cat _output0 >> _output1
+./ci --table $TESTFILE --expr '((price > 5) ? (price / qty) : (_1))' -o _output0
+cat _output0 >> _output1 && rm -f _output0
@@ -0,0 +1,10 @@
+# the times vary from run to run, so list the events of each line in the order recorded
+./ci -T _trace.json -i $TESTFILE -o _output1 && python3 -c '
+import json, sys
+events = json.load(open(sys.argv[1]))["traceEvents"]
+lines = {}
+for e in events:
+    assert e["ph"] == "X" and e["pid"] == 1 and e["dur"] >= 0
+    lines.setdefault(e["args"]["line"], []).append(e["name"])
+for n in sorted(lines): print(n, ", ".join(lines[n]))
+' _trace.json >> _output1; rm -f _trace.json
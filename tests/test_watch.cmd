@@ -0,0 +1,17 @@
+# wait_for n: wait until n passes over the script have been logged
+wait_for() {
+    for i in $(seq 100); do
+        [ "$(grep -c "lines run" _watch_log)" -ge $1 ] && return
+        sleep 0.1
+    done
+}
+cp $TESTFILE /tmp/ci_test_watch.txt
+./ci --watch /tmp/ci_test_watch.txt -o _output1 2> _watch_log &
+wait_for 1
+# only the lines that read a change its run again
+sed -e 's/^a = 2$/a = 4/' -e 's/^(c \* 2)$/(c * 3)/' $TESTFILE > /tmp/ci_test_watch.new
+mv /tmp/ci_test_watch.new /tmp/ci_test_watch.txt
+wait_for 2
+kill -INT $!
+wait $!
+cat _watch_log >&2 && rm -f _watch_log
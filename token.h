@@ -10,6 +10,14 @@
 
 #define MAX_LINE_CHARS 82
 
+/* This enum describes the outcome of reading one line of input. */
+typedef enum {
+    LINE_OK,            // a complete, newline-terminated line
+    LINE_EOF,           // no more input
+    LINE_TOO_LONG,      // longer than MAX_LINE_CHARS - 2 characters
+    LINE_NO_NEWLINE     // the last line of input lacks a newline
+} line_status_t;
+
 /* This enum contains all possible types a token may have. */
 typedef enum {
     TOK_ID,             // identifier
@@ -42,9 +50,13 @@ typedef enum {
     TOK_SEP,            // format separator
     TOK_EOL,            // end of line
     TOK_ASSIGN,         // =
+    TOK_COMMA,          // , between the arguments of a call
+    TOK_LBRACKET,       // [ opening an array literal
+    TOK_RBRACKET,       // ]
     TOK_IDENTITY,       // do nothing
     TOK_FMT_SPEC,       // format specifier: needs to be disambiguated from 
                         // identifier or Boolean literals by parser
+    TOK_CALL,           // call of a built-in function (builtin.c)
     TOK_INVALID = -1    // sentinel
 } token_t;
 
@@ -0,0 +1,119 @@
+/**************************************************************************
+ * C S 429 EEL interpreter
+ *
+ * trace.c - Timeline of interpreter phases in Chrome trace-event format
+ * (-T trace.json).
+ *
+ * Each thread records complete events (a name, a start and an end time and
+ * the input line) into its own ring of TRACE_EVENTS entries, so recording
+ * takes no locks and costs two clock reads per event. When a ring is full
+ * the oldest events are overwritten. At exit every ring is written as a JSON
+ * trace that chrome://tracing and Perfetto can open.
+ *
+ * Copyright (c) 2021. S. Chatterjee, X. Shen, T. Byrd. All rights reserved.
+ * May not be used, modified, or copied without permission.
+ **************************************************************************/
+
+#include "ci.h"
+#include <pthread.h>
+
+#define TRACE_EVENTS 32768
+
+char *trace_file = NULL;
+
+typedef struct trace_event {
+    const char *name;
+    unsigned long start, end;   // nanoseconds on the monotonic clock
+    unsigned long line;
+} trace_event_t;
+
+typedef struct trace_ring {
+    struct trace_ring *next;
+    int tid;
+    unsigned long count;        // events recorded, including overwritten ones
+    trace_event_t events[TRACE_EVENTS];
+} trace_ring_t;
+
+static trace_ring_t *rings = NULL;
+static int num_rings = 0;
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static _Thread_local trace_ring_t *ring = NULL;
+static bool ring_failed = false;
+static char printbuf[100];
+
+static unsigned long now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+unsigned long trace_start(void) {
+    return trace_file ? now() : 0;
+}
+
+void trace_event(const char *name, unsigned long start) {
+    if (! start) return;
+    unsigned long end = now();
+    if (! ring) {
+        if (ring_failed || ! (ring = (trace_ring_t *) malloc(sizeof(trace_ring_t)))) {
+            ring_failed = true;
+            return;
+        }
+        ring->count = 0;
+        pthread_mutex_lock(&rings_lock);
+        ring->tid = ++num_rings;
+        ring->next = rings;
+        rings = ring;
+        pthread_mutex_unlock(&rings_lock);
+    }
+    trace_event_t *e = &ring->events[ring->count++ % TRACE_EVENTS];
+    e->name = name;
+    e->start = start;
+    e->end = end;
+    e->line = input_lineno;
+}
+
+void trace_close(void) {
+    if (! trace_file) return;
+    if (ring_failed) logging(LOG_INFO, "failed to allocate trace buffer; some events were lost");
+
+    /* times are written in microseconds from the first event kept */
+    unsigned long epoch = 0;
+    for (trace_ring_t *r = rings; r; r = r->next) {
+        unsigned long first = r->count > TRACE_EVENTS ? r->count - TRACE_EVENTS : 0;
+        unsigned long t = r->events[first % TRACE_EVENTS].start;
+        if (r->count && (! epoch || t < epoch)) epoch = t;
+    }
+
+    FILE *fp = fopen(trace_file, "w");
+    if (! fp) {
+        sprintf(printbuf, "failed to open trace file %.60s", trace_file);
+        logging(LOG_ERROR, printbuf);
+    } else {
+        const char *sep = "";
+        fprintf(fp, "{\"traceEvents\":[");
+        for (trace_ring_t *r = rings; r; r = r->next) {
+            unsigned long first = r->count > TRACE_EVENTS ? r->count - TRACE_EVENTS : 0;
+            for (unsigned long i = first; i < r->count; i++) {
+                trace_event_t *e = &r->events[i % TRACE_EVENTS];
+                fprintf(fp, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+                        "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"line\":%lu}}",
+                        sep, e->name, r->tid, (e->start - epoch) / 1000.0,
+                        (e->end - e->start) / 1000.0, e->line);
+                sep = ",";
+            }
+        }
+        fprintf(fp, "\n],\"displayTimeUnit\":\"ns\"}\n");
+        if (fclose(fp) != 0) {
+            sprintf(printbuf, "failed to write trace file %.60s", trace_file);
+            logging(LOG_ERROR, printbuf);
+        }
+    }
+    while (rings) {
+        trace_ring_t *r = rings;
+        rings = r->next;
+        free(r);
+    }
+    ring = NULL;
+    trace_file = NULL;
+}
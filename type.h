@@ -16,5 +16,6 @@ typedef enum {
     STRING_TYPE,
     FMT_TYPE,
     ID_TYPE,
+    ARRAY_TYPE,
     NO_TYPE = -1
 } type_t;
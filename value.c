@@ -0,0 +1,97 @@
+/**************************************************************************
+ * C S 429 EEL interpreter
+ *
+ * value.c - Storage of string and array values.
+ *
+ * Short strings live inline in a value_t, so building, copying and freeing
+ * them never touches the heap. See value.h for the layout.
+ *
+ * Copyright (c) 2021. S. Chatterjee, X. Shen, T. Byrd. All rights reserved.
+ * May not be used, modified, or copied without permission.
+ **************************************************************************/
+
+#include "ci.h"
+
+_Thread_local unsigned long str_allocs = 0;
+
+/* alloc_str() - make room for a string of len characters in a value.
+ * Return value: The buffer to fill in, with room for a terminating NUL, or
+ * NULL if it could not be allocated. */
+char *alloc_str(value_t *value, size_t len) {
+    if (len <= SSO_CAPACITY) {
+        value->slen = (unsigned char) len;
+        value->sbuf[len] = '\0';
+        return value->sbuf;
+    }
+    value->sval = (char *) malloc(len + 1);
+    if (! value->sval) {
+        logging(LOG_FATAL, "failed to allocate string");
+        value->slen = 0;
+        value->sbuf[0] = '\0';
+        return NULL;
+    }
+    value->slen = SSO_HEAP;
+    value->sval[len] = '\0';
+    str_allocs++;
+    return value->sval;
+}
+
+/* set_str() - store a copy of str in a value.
+ * Return value: false if it could not be allocated. */
+bool set_str(value_t *value, const char *str) {
+    size_t len = strlen(str);
+    char *buf = alloc_str(value, len);
+    if (! buf) return false;
+    memcpy(buf, str, len);
+    return true;
+}
+
+/* free_str() - release the storage of a string value, unless it is mapped. */
+void free_str(value_t *value) {
+    if (value->slen == SSO_HEAP) free(value->sval);
+    value->slen = 0;
+    value->sbuf[0] = '\0';
+}
+
+/* str_len() - length of a string value. */
+size_t str_len(const value_t *value) {
+    return STR_INLINE(*value) ? value->slen : strlen(value->sval);
+}
+
+/* alloc_array() - make room for an array of len elements in a value.
+ * Return value: The elements to fill in, or NULL if they could not be
+ * allocated. */
+int *alloc_array(value_t *value, int len) {
+    value->aval = (array_t *) malloc(sizeof(array_t) + (size_t) len * sizeof(int));
+    if (! value->aval) {
+        logging(LOG_FATAL, "failed to allocate array");
+        return NULL;
+    }
+    value->aval->len = len;
+    str_allocs++;
+    return value->aval->elems;
+}
+
+/* copy_value() - store a copy of a value of the given type, duplicating any
+ * heap storage it owns.
+ * Return value: false if it could not be allocated. */
+bool copy_value(value_t *dst, const value_t *src, type_t type) {
+    if (type == STRING_TYPE && src->slen == SSO_HEAP) return set_str(dst, src->sval);
+    if (type == ARRAY_TYPE) {
+        int *elems = alloc_array(dst, src->aval->len);
+        if (! elems) return false;
+        memcpy(elems, src->aval->elems, src->aval->len * sizeof(int));
+        return true;
+    }
+    *dst = *src;
+    return true;
+}
+
+/* free_value() - release the storage of a value of the given type. */
+void free_value(value_t *value, type_t type) {
+    if (type == STRING_TYPE) free_str(value);
+    else if (type == ARRAY_TYPE) {
+        free(value->aval);
+        value->aval = NULL;
+    }
+}
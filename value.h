@@ -8,6 +8,26 @@
  * May not be used, modified, or copied without permission.
  **************************************************************************/ 
 
+/* Strings of up to SSO_CAPACITY characters are stored inside the value itself,
+ * with their length in slen. Longer strings are referenced through sval, and
+ * slen tags the pointer: SSO_HEAP if the value owns the allocation, or
+ * SSO_MAPPED if it points into a loaded snapshot image and must not be freed.
+ * Use STR_VAL() to read a string value whichever form it has, and
+ * set_str()/alloc_str()/free_str() to change one. */
+#define SSO_CAPACITY 14
+#define SSO_MAPPED 0xfe
+#define SSO_HEAP 0xff
+#define STR_INLINE(v) ((v).slen <= SSO_CAPACITY)
+#define STR_VAL(v) (STR_INLINE(v) ? (v).sbuf : (v).sval)
+
+/* Integer arrays always live on the heap and are owned by the value that
+ * points to them. Use alloc_array() to make one, and copy_value()/free_value()
+ * to copy or release a value of any type. */
+typedef struct array {
+    int len;            // number of elements
+    int elems[];
+} array_t;
+
 /* Union type in which the result of eval()ing an EEL expression is stored. 
  * The value is arbitrary if the type of the node is NO_TYPE.
  * 
@@ -18,5 +38,10 @@ typedef union value {
     int ival;           // value if type is INT_TYPE
     bool bval;          // value if type is BOOL_TYPE
     char fval;          // value if type is FORMAT_TYPE
-    char *sval;         // value if type is STRING_TYPE
+    char *sval;         // value if type is STRING_TYPE and the string is long
+    array_t *aval;      // value if type is ARRAY_TYPE
+    struct {
+        char sbuf[SSO_CAPACITY + 1];    // value if type is STRING_TYPE and the string is short
+        unsigned char slen;             // length of an inline string, or a pointer tag
+    };
 } value_t, *vptr_t;
@@ -14,7 +14,8 @@
 
 #include "ci.h"
 
-table_t *var_table = NULL;
+_Thread_local table_t *var_table = NULL;
+static _Thread_local unsigned long var_clock = 0;   // source of entry versions
 static char *bool_print[] = {"false", "true"};
 
 void init_table(void) {
@@ -23,39 +24,183 @@ void init_table(void) {
         logging(LOG_FATAL, "failed to allocate table");
         return;
     }
-    var_table->entries = (entry_t **) calloc(CAPACITY, sizeof(entry_t *));
-    if (! var_table->entries) {
-        free(var_table);
-        logging(LOG_FATAL, "failed to allocate entries");
+    return;
+}
+
+/* The slot class for a name, and whether the name fits in the slot. */
+static int slot_class(const char *id, bool *inline_id) {
+    size_t need = sizeof(entry_t) + strlen(id) + 1;
+    int k = 0;
+    while (k < SLOT_CLASSES - 1 && need > SLOT_SIZE(k)) k++;
+    *inline_id = need <= SLOT_SIZE(k);
+    return k;
+}
+
+/* alloc_entry() - take a zeroed entry named id from the slabs, reusing a
+ * released slot of its class if there is one.
+ * Return value: The entry, or NULL if memory ran out. */
+static entry_t *alloc_entry(char *id) {
+    bool inline_id;
+    int k = slot_class(id, &inline_id);
+    char *name = inline_id ? NULL : strdup(id);
+    if (! inline_id && ! name) return NULL;
+
+    entry_t *eptr = var_table->free_slots[k];
+    if (eptr) {
+        var_table->free_slots[k] = (entry_t *) eptr->id;
+    } else {
+        slab_t *slab = var_table->slabs[k];
+        if (! slab || slab->used == (SLAB_SIZE - sizeof(slab_t)) / SLOT_SIZE(k)) {
+            if (! (slab = (slab_t *) malloc(SLAB_SIZE))) {
+                free(name);
+                return NULL;
+            }
+            slab->next = var_table->slabs[k];
+            slab->used = 0;
+            var_table->slabs[k] = slab;
+        }
+        eptr = (entry_t *) (slab->mem + slab->used++ * SLOT_SIZE(k));
     }
+    memset(eptr, 0, sizeof(entry_t));
+    eptr->id = inline_id ? strcpy((char *) (eptr + 1), id) : name;
+    return eptr;
+}
+
+/* The release functions drop one reference and free what is no longer
+ * referenced by any version of the table. */
+static void release_entry(entry_t *eptr) {
+    if (! eptr || --eptr->refs > 0) return;
+    free_value(&eptr->val, eptr->type);
+    bool inline_id;
+    int k = slot_class(eptr->id, &inline_id);
+    if (! inline_id) free(eptr->id);
+    eptr->id = (char *) var_table->free_slots[k];
+    var_table->free_slots[k] = eptr;
     return;
 }
 
-void delete_entry(entry_t *eptr) {
-    if (! eptr) return;
-    if (eptr->type == STRING_TYPE) {
-        free(eptr->val.sval);
+/* Set when an update has to copy trie nodes or a bucket shared with a saved
+ * version; such updates are traced (-T). */
+static _Thread_local bool path_copied = false;
+
+/* Set by delete_table(), which frees the entries slab by slab instead. */
+static _Thread_local bool dropping_slabs = false;
+
+static void release_bucket(bucket_t *bptr) {
+    if (! bptr || --bptr->refs > 0) return;
+    for (int i = 0; i < bptr->count && ! dropping_slabs; i++) {
+        release_entry(bptr->entries[i]);
     }
-    free(eptr->id);
-    free(eptr);
+    free(bptr);
     return;
 }
 
-void delete_entries(entry_t *eptr) {
-    if (! eptr) return;
-    delete_entries(eptr->next);
-    delete_entry(eptr);
+static void release_trie(trie_t *tptr, int level) {
+    if (! tptr || --tptr->refs > 0) return;
+    int n = __builtin_popcount(tptr->bitmap);
+    for (int i = 0; i < n; i++) {
+        if (level + 1 < TRIE_LEVELS) release_trie(tptr->children[i], level + 1);
+        else release_bucket(tptr->children[i]);
+    }
+    free(tptr);
     return;
 }
 
+/* Free every slab, along with the strings and long names of the entries
+ * still live in it. */
+static void drop_slabs(void) {
+    for (int k = 0; k < SLOT_CLASSES; k++) {
+        while (var_table->slabs[k]) {
+            slab_t *slab = var_table->slabs[k];
+            for (size_t i = 0; i < slab->used; i++) {
+                entry_t *eptr = (entry_t *) (slab->mem + i * SLOT_SIZE(k));
+                if (eptr->refs == 0) continue;
+                free_value(&eptr->val, eptr->type);
+                if (eptr->id != (char *) (eptr + 1)) free(eptr->id);
+            }
+            var_table->slabs[k] = slab->next;
+            free(slab);
+        }
+    }
+}
+
+/* The name index is built on the first ordered query and then kept up to
+ * date as variables are defined, until a rollback removes some of them. */
+static void drop_index(void) {
+    for (int i = 0; i < var_table->nnames; i++) free(var_table->names[i]);
+    free(var_table->names);
+    var_table->names = NULL;
+    var_table->nnames = var_table->names_cap = 0;
+    var_table->indexed = false;
+}
+
+/* Position of the first name not less than id. */
+static int lower_bound(char **names, int n, const char *id) {
+    int lo = 0, hi = n;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (strcmp(names[mid], id) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/* index_name() - add the name of a new variable to the index.
+ * Return value: false if memory ran out; the index is dropped then. */
+static bool index_name(const char *id) {
+    if (! var_table->indexed) return true;
+    if (var_table->nnames == var_table->names_cap) {
+        int ncap = var_table->names_cap ? var_table->names_cap * 2 : 64;
+        char **nnames = realloc(var_table->names, ncap * sizeof(char *));
+        if (! nnames) {
+            drop_index();
+            return false;
+        }
+        var_table->names = nnames;
+        var_table->names_cap = ncap;
+    }
+    char *name = strdup(id);
+    if (! name) {
+        drop_index();
+        return false;
+    }
+    int i = lower_bound(var_table->names, var_table->nnames, id);
+    memmove(&var_table->names[i + 1], &var_table->names[i],
+            (var_table->nnames - i) * sizeof(char *));
+    var_table->names[i] = name;
+    var_table->nnames++;
+    return true;
+}
+
+static void index_entry(entry_t *eptr, void *arg) {
+    *(bool *) arg = *(bool *) arg && index_name(eptr->id);
+}
+
+static bool build_index(void) {
+    if (var_table->indexed) return true;
+    bool ok = true;
+    var_table->indexed = true;
+    for_each_entry(index_entry, &ok);
+    return ok;
+}
+
 void delete_table(void) {
     if (! var_table) return;
 
-    for (int i = 0; i < CAPACITY; ++i) {
-        delete_entries(var_table->entries[i]);
+    dropping_slabs = true;
+    release_trie(var_table->root, 0);
+    while (var_table->scopes) {
+        scope_t *scope = var_table->scopes;
+        var_table->scopes = scope->next;
+        release_trie(scope->root, 0);
+        free(scope);
     }
-    free(var_table->entries);
+    dropping_slabs = false;
+    drop_slabs();
+    drop_index();
     free(var_table);
+    var_table = NULL;
+    release_snapshots();
     return;
 }
 
@@ -67,126 +212,206 @@ unsigned long hash_function(char *s) {
     return i % CAPACITY;
 }
 
-/* init_entry() - provided entry constructor
- * Parameters: Variable name, pointer to a node.
- * Return value: An allocated entry. */
-entry_t * init_entry(char *id, node_t *nptr) {
-    if (nptr == NULL) {
-        logging(LOG_FATAL, "failed to allocate entry");
-        return NULL;
-    }
-    entry_t *eptr = (entry_t *) calloc(1, sizeof(entry_t));
-    if (! eptr) {
-        logging(LOG_FATAL, "failed to allocate entry");
-        return NULL;
-    }
-    eptr->id = (char *) malloc(strlen(id) + 1);
-    if (! id) {
-        logging(LOG_FATAL, "failed to allocate entry id");
-        free(eptr);
-        return NULL;
-    }
-    strcpy(eptr->id, id);
-    eptr->type = nptr->type;
-    if (eptr->type == STRING_TYPE) {
-        (eptr->val).sval = (char *) malloc(strlen(nptr->val.sval) + 1);
-        if (! eptr->val.sval) {
-            logging(LOG_FATAL, "failed to allocate string");
-            free(eptr->id);
-            free(eptr);
-            return NULL;
-        }
-        strcpy(eptr->val.sval, nptr->val.sval);
-    } else {
-        eptr->val.ival = nptr->val.ival;
+/* The child of a trie node at the given level on the path to bucket b. */
+static int trie_index(unsigned long b, int level) {
+    return (b >> (TRIE_BITS * (TRIE_LEVELS - 1 - level))) & ((1 << TRIE_BITS) - 1);
+}
+
+/* own_trie() - return a node that only the current version references, in
+ * place of tptr. A shared node is copied and its children gain a reference.
+ * Return value: The node, or NULL if it could not be copied. */
+static trie_t *own_trie(trie_t *tptr, int level) {
+    if (tptr->refs == 1) return tptr;
+    path_copied = true;
+    int n = __builtin_popcount(tptr->bitmap);
+    trie_t *copy = (trie_t *) malloc(sizeof(trie_t) + n * sizeof(void *));
+    if (! copy) return NULL;
+    copy->refs = 1;
+    copy->bitmap = tptr->bitmap;
+    memcpy(copy->children, tptr->children, n * sizeof(void *));
+    for (int i = 0; i < n; i++) {
+        if (! copy->children[i]) continue;
+        if (level + 1 < TRIE_LEVELS) ((trie_t *) copy->children[i])->refs++;
+        else ((bucket_t *) copy->children[i])->refs++;
     }
-    return eptr;
+    tptr->refs--;
+    return copy;
 }
 
-/* put() - insert an entry into the hashtable or update the existing entry.
- * Use a linked list to handle collisions.
- * Parameters: Variable name, pointer to a node.
- * Return value: None.
- * Side effect: The entry is inserted into the hashtable, or is updated if
- * it already exists.
- * (STUDENT TODO) 
- */
+/* own_bucket() - like own_trie, for a possibly NULL bucket, leaving room for
+ * extra more entries. */
+static bucket_t *own_bucket(bucket_t *bptr, int extra) {
+    int count = bptr ? bptr->count : 0;
+    size_t size = sizeof(bucket_t) + (count + extra) * sizeof(entry_t *);
+    if (bptr && bptr->refs == 1) {
+        return extra ? (bucket_t *) realloc(bptr, size) : bptr;
+    }
+    // a new bucket is not a copy
+    if (bptr) path_copied = true;
+    bucket_t *copy = (bucket_t *) malloc(size);
+    if (! copy) return NULL;
+    copy->refs = 1;
+    copy->count = count;
+    for (int i = 0; i < count; i++) {
+        copy->entries[i] = bptr->entries[i];
+        copy->entries[i]->refs++;
+    }
+    if (bptr) bptr->refs--;
+    return copy;
+}
 
-void put(char *id, node_t *nptr) {
+/* own_path() - make every trie node on the path to bucket b private to the
+ * current version, creating missing ones.
+ * Return value: The link to the bucket, or NULL if memory ran out. */
+static void **own_path(unsigned long b) {
+    void **link = (void **) &var_table->root;
+    for (int level = 0; level < TRIE_LEVELS; level++) {
+        trie_t *tptr = *link ? own_trie(*link, level) : (trie_t *) calloc(1, sizeof(trie_t));
+        if (! tptr) return NULL;
+        if (! *link) tptr->refs = 1;
+        *link = tptr;
 
-    entry_t* temp = var_table->entries[hash_function(id)];
+        unsigned int bit = 1u << trie_index(b, level);
+        int pos = __builtin_popcount(tptr->bitmap & (bit - 1));
+        if (! (tptr->bitmap & bit)) {
+            int n = __builtin_popcount(tptr->bitmap);
+            trie_t *grown = (trie_t *) realloc(tptr, sizeof(trie_t) + (n + 1) * sizeof(void *));
+            if (! grown) return NULL;
+            memmove(&grown->children[pos + 1], &grown->children[pos], (n - pos) * sizeof(void *));
+            grown->children[pos] = NULL;
+            grown->bitmap |= bit;
+            *link = tptr = grown;
+        }
+        link = &tptr->children[pos];
+    }
+    return link;
+}
 
-    // Initialize 1st entry if needed
-    if(!temp) {
-        var_table->entries[hash_function(id)] = init_entry(id, nptr);
+/* store() - define or update a variable in the current version.
+ * Parameters: Variable name, type and value. The table takes over the value.
+ * Return value: None. */
+static void store(char *id, type_t type, value_t val) {
+    unsigned long start = trace_start();
+    // ci -e starts without a table
+    if (! var_table) init_table();
+    if (! var_table) {
+        free_value(&val, type);
         return;
     }
-
-    bool match = strcmp(temp->id, id) == 0;
-    while(temp->next != NULL && !match) {
-        temp = temp->next;
-        match = strcmp(temp->id, id) == 0;
+    path_copied = false;
+    void **link = own_path(hash_function(id));
+    bucket_t *bptr = link ? (bucket_t *) *link : NULL;
+    int i = 0;
+    while (bptr && i < bptr->count && strcmp(bptr->entries[i]->id, id) != 0) i++;
+    bool found = bptr && i < bptr->count;
+    if (link) bptr = own_bucket(bptr, found ? 0 : 1);
+    if (! link || ! bptr) {
+        logging(LOG_FATAL, "failed to allocate variable table");
+        free_value(&val, type);
+        return;
     }
+    *link = bptr;
 
-    // Update existing entry
-    if(match) {
-        if(temp->type == STRING_TYPE) {
-            free(temp->val.sval);
+    entry_t *eptr = found ? bptr->entries[i] : NULL;
+    if (eptr && eptr->refs == 1) {
+        // no saved version can see this entry, so update it in place
+        free_value(&eptr->val, eptr->type);
+    } else {
+        entry_t *fresh = alloc_entry(id);
+        if (! fresh) {
+            logging(LOG_FATAL, "failed to allocate entry");
+            free_value(&val, type);
+            return;
         }
-
-        temp->type = nptr->type;
-        if (temp->type == STRING_TYPE) {
-            (temp->val).sval = (char *) malloc(strlen(nptr->val.sval) + 1);
-            if (! temp->val.sval) {
-                logging(LOG_FATAL, "failed to allocate string");
-                return;
-            }
-            strcpy(temp->val.sval, nptr->val.sval);
-        } else {
-            temp->val.ival = nptr->val.ival;
+        fresh->refs = 1;
+        if (eptr) release_entry(eptr);
+        else {
+            bptr->count++;
+            index_name(id);
         }
-        return;
+        eptr = bptr->entries[i] = fresh;
     }
+    eptr->type = type;
+    eptr->val = val;
+    eptr->version = ++var_clock;
+    if (path_copied) trace_event("put (copy)", start);
+    return;
+}
 
-    // Create new entry
-    if(temp->next == NULL) {
-        temp->next = init_entry(id, nptr);
-        return;
-    }
+/* put() - insert an entry into the hashtable or update the existing entry.
+ * Parameters: Variable name, pointer to a node.
+ * Return value: None.
+ * Side effect: The entry is inserted into the hashtable, or is updated if
+ * it already exists.
+ */
+
+void put(char *id, node_t *nptr) {
+    value_t val;
+    if (! copy_value(&val, &nptr->val, nptr->type)) return;
+    store(id, nptr->type, val);
+    return;
+}
+
+/* put_mapped() - insert or update an entry without copying its string value.
+ * Parameters: Variable name, type and value. A string value must stay valid
+ * until release_snapshots() is called.
+ * Return value: None. */
+void put_mapped(char *id, type_t type, value_t val) {
+    store(id, type, val);
     return;
 }
 
-/* get() - search for an entry in the hashtable.
+/* get() - search for an entry in the hashtable, and then among the shared
+ * variables (--shared-vars).
  * Parameter: Variable name.
- * Return value: Pointer to the matching entry, or NULL if not found.
- * (STUDENT TODO) 
+ * Return value: Pointer to the matching entry, or NULL if not found. The
+ * entry may change or go away at the next update of the table, or for a
+ * shared variable at a later get().
  */
-entry_t* get(char* id) {
+static entry_t *find_entry(char *id) {
+    if (! var_table) return NULL;
 
-    entry_t* result = var_table->entries[hash_function(id)];
-    
-    if(result != NULL) {
+    unsigned long b = hash_function(id);
+    void *node = var_table->root;
+    for (int level = 0; level < TRIE_LEVELS; level++) {
+        trie_t *tptr = node;
+        if (! tptr) return NULL;
+        unsigned int bit = 1u << trie_index(b, level);
+        if (! (tptr->bitmap & bit)) return NULL;
+        node = tptr->children[__builtin_popcount(tptr->bitmap & (bit - 1))];
+    }
 
-        if(strcmp(result->id, id) == 0) {
-                return result;
+    bucket_t *bptr = node;
+    for (int i = 0; bptr && i < bptr->count; i++) {
+        if (strcmp(bptr->entries[i]->id, id) == 0) {
+            return bptr->entries[i];
         }
+    }
+    return NULL;
+}
 
-        while(result->next != NULL) {
-
-            result = result->next;
+entry_t* get(char* id) {
+    entry_t *eptr = find_entry(id);
+    return eptr || ! shared_vars ? eptr : shared_get(id);
+}
 
-            if(strcmp(result->id, id) == 0) {
-                return result;
-            }
-        }
-        
+static void visit(void *node, int level, void (*fn)(entry_t *, void *), void *arg) {
+    if (! node) return;
+    if (level == TRIE_LEVELS) {
+        bucket_t *bptr = node;
+        for (int i = 0; i < bptr->count; i++) fn(bptr->entries[i], arg);
+        return;
     }
+    trie_t *tptr = node;
+    int n = __builtin_popcount(tptr->bitmap);
+    for (int i = 0; i < n; i++) visit(tptr->children[i], level + 1, fn, arg);
+}
 
-    return NULL;
+void for_each_entry(void (*fn)(entry_t *, void *), void *arg) {
+    if (var_table) visit(var_table->root, 0, fn, arg);
 }
 
-void print_entry(entry_t *eptr) {
-    if (! eptr) return;
+static void print_entry(entry_t *eptr, void *arg) {
     switch (eptr->type) {
         case INT_TYPE:
             fprintf(outfile, "%s = %d; ", eptr->id, eptr->val.ival);
@@ -195,13 +420,17 @@ void print_entry(entry_t *eptr) {
             fprintf(outfile, "%s = %s; ", eptr->id, bool_print[eptr->val.bval]);
             break;
         case STRING_TYPE:
-            fprintf(outfile, "%s = \"%s\"; ", eptr->id, eptr->val.sval);
+            fprintf(outfile, "%s = \"%s\"; ", eptr->id, STR_VAL(eptr->val));
+            break;
+        case ARRAY_TYPE:
+            fprintf(outfile, "%s = ", eptr->id);
+            print_array(eptr->val.aval, 'd');
+            fprintf(outfile, "; ");
             break;
         default:
             logging(LOG_ERROR, "unsupported entry type for printing");
             break;
     }
-    print_entry(eptr->next);
     return;
 }
 
@@ -211,9 +440,96 @@ void print_table(void) {
         return;
     }
     fprintf(outfile, "\t");
-    for (int i = 0; i < CAPACITY; ++i) {
-        print_entry(var_table->entries[i]);
+    for_each_entry(print_entry, NULL);
+    // then the shared variables not shadowed here
+    char **shared = NULL;
+    int nshared = shared_vars ? shared_names(&shared) : 0;
+    for (int i = 0; i < nshared; i++) {
+        if (! find_entry(shared[i])) print_entry(shared_get(shared[i]), NULL);
     }
     fprintf(outfile, "\n");
     return;
 }
+
+void print_range(char *lo, char *hi) {
+    if (! var_table) {
+        logging(LOG_ERROR, "variable table doesn't exist");
+        return;
+    }
+    if (! build_index()) {
+        logging(LOG_FATAL, "failed to allocate variable index");
+        return;
+    }
+    // merge the local names with the shared ones, which they shadow
+    char **names = var_table->names, **shared = NULL;
+    int n = var_table->nnames, nshared = shared_vars ? shared_names(&shared) : 0;
+    int i = lower_bound(names, n, lo), j = nshared ? lower_bound(shared, nshared, lo) : 0;
+    fprintf(outfile, "\t");
+    while (i < n || j < nshared) {
+        int cmp = i == n ? 1 : j == nshared ? -1 : strcmp(names[i], shared[j]);
+        char *id = cmp <= 0 ? names[i] : shared[j];
+        if (hi && strcmp(id, hi) >= 0) break;
+        print_entry(get(id), NULL);
+        i += cmp <= 0;
+        j += cmp >= 0;
+    }
+    fprintf(outfile, "\n");
+    return;
+}
+
+void print_prefix(char *prefix) {
+    /* names with the prefix sort before the prefix with its last character
+     * bumped, and names are alphanumeric so the bump cannot overflow */
+    size_t len = strlen(prefix);
+    char hi[len + 1];
+    memcpy(hi, prefix, len + 1);
+    hi[len - 1]++;
+    print_range(prefix, hi);
+    return;
+}
+
+void fork_table(void) {
+    if (! var_table) {
+        logging(LOG_ERROR, "variable table doesn't exist");
+        return;
+    }
+    scope_t *scope = (scope_t *) malloc(sizeof(scope_t));
+    if (! scope) {
+        logging(LOG_FATAL, "failed to allocate scope");
+        return;
+    }
+    scope->root = var_table->root;
+    if (scope->root) scope->root->refs++;
+    scope->next = var_table->scopes;
+    var_table->scopes = scope;
+    return;
+}
+
+/* pop_scope() - remove the innermost scope, reporting an error if none.
+ * Return value: The version it saved in *root; false if there was none. */
+static bool pop_scope(trie_t **root) {
+    scope_t *scope = var_table ? var_table->scopes : NULL;
+    if (! scope) {
+        logging(LOG_ERROR, "no @fork to end");
+        return false;
+    }
+    var_table->scopes = scope->next;
+    *root = scope->root;
+    free(scope);
+    return true;
+}
+
+void commit_table(void) {
+    trie_t *saved;
+    if (pop_scope(&saved)) release_trie(saved, 0);
+    return;
+}
+
+void rollback_table(void) {
+    trie_t *saved;
+    if (! pop_scope(&saved)) return;
+    release_trie(var_table->root, 0);
+    var_table->root = saved;
+    drop_index();
+    return;
+}
@@ -11,18 +11,66 @@
 
 #define CAPACITY 100
 
-/* Entry of the hashtable, which stores a defined variable.
- * A next pointer is provided to handle collision with linked list */
+/* The table is persistent: each version of it is a trie indexed TRIE_BITS
+ * bits at a time by a variable's bucket number, with the buckets as leaves.
+ * Trie nodes, buckets and entries are reference counted and shared between
+ * versions, so saving a version (@fork) is O(1), and an update copies only
+ * the nodes on its path that a saved version still shares. */
+#define TRIE_BITS 4
+#define TRIE_LEVELS 2       // enough for CAPACITY buckets
+
+/* Entry of the hashtable, which stores a defined variable. Entries shared by
+ * several versions of the table are never modified. */
 typedef struct entry {
     char *id;               // variable name used for indexing
     value_t val;            // variable value
-    type_t type;            // variable data type
-    struct entry *next;     // points for linked list implementation
+    type_t type : 8;        // variable data type
+    unsigned int refs;      // buckets referencing the entry
+    unsigned long version;  // changes whenever the variable is assigned
 } entry_t;
 
+/* The variables of one bucket, in the order they were defined. */
+typedef struct bucket {
+    unsigned int refs;      // trie nodes referencing the bucket
+    int count;
+    entry_t *entries[];
+} bucket_t;
+
+/* Inner node of the trie. Only the children present in bitmap are stored. */
+typedef struct trie {
+    unsigned int refs;      // parents and saved versions referencing the node
+    unsigned short bitmap;
+    void *children[];       // trie_t at inner levels, bucket_t at the last one
+} trie_t;
+
+/* A version of the table saved by @fork. */
+typedef struct scope {
+    trie_t *root;
+    struct scope *next;     // enclosing scope
+} scope_t;
+
+/* Entries are carved out of SLAB_SIZE byte slabs owned by the table. A slot
+ * of class k is SLOT_SIZE(k) bytes and holds the entry followed by its name;
+ * names too long for the largest class are allocated separately. */
+#define SLAB_SIZE 65536
+#define SLOT_CLASSES 3
+#define SLOT_SIZE(k) (64 << (k))
+
+typedef struct slab {
+    struct slab *next;
+    size_t used;            // slots handed out so far
+    char mem[];
+} slab_t;
+
 /* Hashtable that stores all the defined variables. */
 typedef struct table {
-    entry_t **entries;
+    trie_t *root;           // current version, or NULL while empty
+    scope_t *scopes;        // versions saved by @fork, innermost first
+    char **names;           // sorted names of the current variables
+    int nnames, names_cap;  // names is only maintained once indexed is set
+    bool indexed;
+    slab_t *slabs[SLOT_CLASSES];
+    entry_t *free_slots[SLOT_CLASSES];  // released entries, linked by id
 } table_t;
 
 /* Initialize the global hashtable. */
@@ -31,5 +79,35 @@ extern void init_table(void);
 /* Release allocated memory for the table. */
 extern void delete_table(void);
 
-/* list all entries stored in the table. */
+/* list all entries stored in the table, then the shared variables
+ * (--shared-vars) it does not shadow. */
 extern void print_table(void);
+
+/* List the entries whose names start with prefix (@p prefix), or lie in the
+ * range [lo, hi) (@p lo..hi), in name order, shared variables included. */
+extern void print_prefix(char *prefix);
+extern void print_range(char *lo, char *hi);
+
+/* Call fn on every entry, in the order print_table lists them. */
+extern void for_each_entry(void (*fn)(entry_t *, void *), void *arg);
+
+/* Nested scopes: fork_table saves the current variables (@fork),
+ * commit_table keeps the changes made since the matching fork (@commit) and
+ * rollback_table restores the variables it saved (@rollback). */
+extern void fork_table(void);
+extern void commit_table(void);
+extern void rollback_table(void);
+
+/* Insert or update an entry whose string value is referenced in place rather
+ * than copied; such strings are tagged SSO_MAPPED. The entry stops
+ * referencing it once the variable is updated. */
+extern void put_mapped(char *id, type_t type, value_t val);
+
+/* Write the table to a binary snapshot file (@save). */
+extern void save_table(char *path);
+
+/* Restore variables from a binary snapshot file by mapping it (@load). */
+extern void load_table(char *path);
+
+/* Unmap all snapshot images. Only call once no entry references them. */
+extern void release_snapshots(void);
@@ -0,0 +1,599 @@
+/**************************************************************************
+ * C S 429 EEL interpreter
+ *
+ * watch.c - Re-run a script incrementally as it is edited (--watch file).
+ *
+ * The script is run once, keeping the AST of every line along with the
+ * value it assigned and the output it printed. The file is then watched
+ * with inotify, and each time it is written the new version is diffed
+ * against the old one line by line. Only edited and inserted lines are
+ * parsed again; the others keep their ASTs and results.
+ *
+ * Each pass replays the script from the top with a fresh variable table.
+ * A line is evaluated again only if it is new or reads a dirty variable,
+ * one whose value at that point may differ from the last pass; any other
+ * assignment just stores the value it produced last time. A variable gets
+ * dirty when a line assigning it is deleted or evaluates to a different
+ * value, and clean again at the next assignment that keeps its value.
+ * Commands run on every pass, and those that can change variables other
+ * than by assignment (@load, @fork, ...) make every later line dirty.
+ *
+ * Only outputs that differ from the last pass are printed, each preceded
+ * by its line number.
+ *
+ * Copyright (c) 2021. S. Chatterjee, X. Shen, T. Byrd. All rights reserved.
+ * May not be used, modified, or copied without permission.
+ **************************************************************************/
+
+#include "ci.h"
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/inotify.h>
+
+extern void set_input_line(const char *line);
+
+/* Versions of the script differing in more lines than this are not diffed
+ * further; everything between their common prefix and suffix is new. */
+#define DIFF_MAX_EDITS 1000
+
+char *watch_file = NULL;
+
+static char printbuf[100];
+static volatile sig_atomic_t interrupted = 0;
+
+/* What is kept of one line of the script from one pass to the next. */
+typedef struct line {
+    char *text;             // the line, with its newline
+    uint64_t hash;          // hash of text
+    bool command;           // a command, run on every pass
+    bool parsed;            // tree and reads are set
+    bool stale;             // must be evaluated on the next pass
+    node_t *tree;           // AST before type inference, NULL if it failed to parse
+    const char **reads;     // names of the variables tree reads, held in its leaves
+    int nreads;
+    type_t type;            // value the line last assigned, NO_TYPE if none
+    value_t val;
+    char *output;           // what the line printed when it last ran
+    size_t output_len;
+} line_t;
+
+typedef struct script {
+    line_t *lines;
+    int n;
+} script_t;
+
+/* 64-bit FNV-1a hash. */
+static uint64_t hash_text(const char *s) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (; *s; s++) {
+        h ^= (unsigned char) *s;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static void free_script(script_t *script) {
+    for (int i = 0; i < script->n; i++) {
+        line_t *line = &script->lines[i];
+        free(line->text);
+        cleanup(line->tree);
+        free(line->reads);
+        free_value(&line->val, line->type);
+        free(line->output);
+    }
+    free(script->lines);
+    script->lines = NULL;
+    script->n = 0;
+}
+
+/* load_script() - read a script and split it into fresh lines.
+ * Return value: false if it could not be read. */
+static bool load_script(const char *path, script_t *script) {
+    FILE *fp = fopen(path, "r");
+    if (! fp) return false;
+    size_t cap = 4096, len = 0, n;
+    char *data = malloc(cap);
+    while (data && (n = fread(data + len, 1, cap - len - 1, fp)) > 0) {
+        len += n;
+        if (len == cap - 1) {
+            char *ndata = realloc(data, cap *= 2);
+            if (! ndata) free(data);
+            data = ndata;
+        }
+    }
+    fclose(fp);
+    if (! data) return false;
+    data[len] = '\0';
+
+    int count = 0;
+    for (size_t i = 0; i < len; i++) count += data[i] == '\n';
+    if (len > 0 && data[len - 1] != '\n') count++;
+    script->n = 0;
+    script->lines = calloc(count ? count : 1, sizeof(line_t));
+    bool ok = script->lines != NULL;
+    for (char *p = data; ok && p < data + len; script->n++) {
+        char *nl = strchr(p, '\n');
+        size_t llen = nl ? (size_t) (nl - p) : strlen(p);
+        line_t *line = &script->lines[script->n];
+        line->type = NO_TYPE;
+        line->stale = true;
+        if (! (line->text = malloc(llen + 2))) {
+            ok = false;
+            break;
+        }
+        memcpy(line->text, p, llen);
+        strcpy(line->text + llen, "\n");
+        line->hash = hash_text(line->text);
+        line->command = line->text[strspn(line->text, " \t")] == '@';
+        p += llen + 1;
+    }
+    free(data);
+    if (! ok) {
+        free_script(script);
+        logging(LOG_FATAL, "failed to allocate script");
+    }
+    return ok;
+}
+
+static bool same_line(const line_t *a, const line_t *b) {
+    return a->hash == b->hash && strcmp(a->text, b->text) == 0;
+}
+
+/* diff_script() - match the lines of cur against those of old with Myers'
+ * O(ND) algorithm, once their common prefix and suffix are set aside.
+ * match[i] is set to the index in old of line i of cur, or -1 if the line
+ * is new. Matched lines take over the state of the old ones. */
+static void diff_script(script_t *old, script_t *cur, int *match) {
+    line_t *a = old->lines, *b = cur->lines;
+    int n = old->n, m = cur->n, pre = 0, suf = 0;
+    for (int i = 0; i < m; i++) match[i] = -1;
+    while (pre < n && pre < m && same_line(&a[pre], &b[pre])) {
+        match[pre] = pre;
+        pre++;
+    }
+    while (suf < n - pre && suf < m - pre && same_line(&a[n - 1 - suf], &b[m - 1 - suf])) {
+        match[m - 1 - suf] = n - 1 - suf;
+        suf++;
+    }
+
+    // v[off + k] is the furthest x reached on diagonal k = x - y; trace[d]
+    // keeps v[-d..d] after d edits, for walking the path back
+    a += pre;
+    b += pre;
+    n -= pre + suf;
+    m -= pre + suf;
+    int dmax = n + m < DIFF_MAX_EDITS ? n + m : DIFF_MAX_EDITS;
+    int off = dmax + 1;
+    int *v = calloc(2 * dmax + 3, sizeof(int));
+    int **trace = calloc(dmax + 1, sizeof(int *));
+    int d = 0, x = 0, y = 0;
+    bool found = false;
+    while (v && trace && d <= dmax) {
+        for (int k = -d; k <= d && ! found; k += 2) {
+            bool down = k == -d || (k != d && v[off + k - 1] < v[off + k + 1]);
+            x = down ? v[off + k + 1] : v[off + k - 1] + 1;
+            y = x - k;
+            while (x < n && y < m && same_line(&a[x], &b[y])) {
+                x++;
+                y++;
+            }
+            v[off + k] = x;
+            found = x >= n && y >= m;
+        }
+        if (found || ! (trace[d] = malloc((2 * d + 1) * sizeof(int)))) break;
+        memcpy(trace[d], v + off - d, (2 * d + 1) * sizeof(int));
+        d++;
+    }
+    if (found) {
+        for (x = n, y = m; d > 0; d--) {
+            int *prev = trace[d - 1] + d - 1;
+            int k = x - y;
+            int pk = k == -d || (k != d && prev[k - 1] < prev[k + 1]) ? k + 1 : k - 1;
+            int px = prev[pk], py = px - pk;
+            while (x > px && y > py) {
+                x--;
+                y--;
+                match[pre + y] = pre + x;
+            }
+            x = px;
+            y = py;
+        }
+        while (x > 0 && y > 0) {
+            x--;
+            y--;
+            match[pre + y] = pre + x;
+        }
+    }
+    for (int i = 0; trace && i <= dmax && trace[i]; i++) free(trace[i]);
+    free(trace);
+    free(v);
+
+    for (int i = 0; i < cur->n; i++) {
+        if (match[i] < 0) continue;
+        line_t *from = &old->lines[match[i]], *to = &cur->lines[i];
+        char *text = to->text;
+        *to = *from;
+        to->text = text;
+        from->tree = NULL;
+        from->reads = NULL;
+        from->type = NO_TYPE;
+        from->output = NULL;
+    }
+}
+
+/* What the current pass knows about each variable assigned so far, in an
+ * open-addressing set of names. A replayed assignment does not store its
+ * value right away: it becomes the variable's pending line, and is stored
+ * only before a line that reads the variable runs, so that replaying a long
+ * unchanged script costs little more than reading it. */
+typedef struct var_state {
+    const char *name;
+    bool dirty;             // may differ from its value at this point in the last pass
+    line_t *pending;        // replayed assignment not yet stored in the table
+} var_state_t;
+
+static var_state_t *vars = NULL;
+static size_t vars_cap = 0, vars_used = 0, dirty_count = 0, pending_count = 0;
+
+static var_state_t *find_var(const char *name) {
+    size_t i = hash_text(name) & (vars_cap - 1);
+    while (vars[i].name && strcmp(vars[i].name, name) != 0)
+        i = (i + 1) & (vars_cap - 1);
+    return &vars[i];
+}
+
+/* var_state() - look up a variable, adding it if create is set.
+ * Return value: Its state, or NULL if it is not there or not enough memory. */
+static var_state_t *var_state(const char *name, bool create) {
+    if (vars_cap == 0 && ! create) return NULL;
+    if (create && (vars_used + 1) * 2 > vars_cap) {
+        var_state_t *old = vars;
+        size_t old_cap = vars_cap;
+        vars_cap = vars_cap ? vars_cap * 2 : 64;
+        if (! (vars = calloc(vars_cap, sizeof(var_state_t)))) {
+            logging(LOG_FATAL, "failed to allocate variable states");
+            vars = old;
+            vars_cap = old_cap;
+            return NULL;
+        }
+        for (size_t i = 0; i < old_cap; i++)
+            if (old[i].name) *find_var(old[i].name) = old[i];
+        free(old);
+    }
+    var_state_t *var = find_var(name);
+    if (! var->name) {
+        if (! create) return NULL;
+        var->name = name;
+        vars_used++;
+    }
+    return var;
+}
+
+static void set_dirty(var_state_t *var, bool dirty) {
+    if (var->dirty != dirty) dirty_count += dirty ? 1 : -1;
+    var->dirty = dirty;
+}
+
+static void clear_vars(void) {
+    if (vars) memset(vars, 0, vars_cap * sizeof(var_state_t));
+    vars_used = dirty_count = pending_count = 0;
+}
+
+/* store_pending() - store the value of a variable's pending line. */
+static void store_pending(var_state_t *var) {
+    line_t *line = var->pending;
+    value_t val;
+    var->pending = NULL;
+    pending_count--;
+    if (copy_value(&val, &line->val, line->type))
+        put_mapped((char *) var->name, line->type, val);
+}
+
+static void store_all_pending(void) {
+    for (size_t i = 0; i < vars_cap && pending_count; i++)
+        if (vars[i].pending) store_pending(&vars[i]);
+}
+
+/* The variable a line assigns, or NULL. */
+static const char *assigned_name(const line_t *line) {
+    if (! line->tree || line->tree->type != ID_TYPE || ! line->tree->children[0]) return NULL;
+    return STR_VAL(line->tree->children[0]->val);
+}
+
+static bool reads_dirty(const line_t *line) {
+    for (int i = 0; i < line->nreads && dirty_count; i++) {
+        var_state_t *var = var_state(line->reads[i], false);
+        if (var && var->dirty) return true;
+    }
+    return false;
+}
+
+/* Collect the names of the variables read by a subtree.
+ * Return value: false if they could not be stored. */
+static bool collect_reads(line_t *line, node_t *nptr, int *cap) {
+    if (! nptr) return true;
+    if (nptr->node_type == NT_LEAF && nptr->type == ID_TYPE) {
+        if (line->nreads == *cap) {
+            *cap = *cap ? *cap * 2 : 4;
+            const char **nreads = realloc(line->reads, *cap * sizeof(char *));
+            if (! nreads) return false;
+            line->reads = nreads;
+        }
+        line->reads[line->nreads++] = STR_VAL(nptr->val);
+        return true;
+    }
+    for (int i = 0; i < 3; i++)
+        if (! collect_reads(line, nptr->children[i], cap)) return false;
+    return true;
+}
+
+/* clone_tree() - copy a parsed tree so it can be evaluated while the
+ * original is kept. Shared subtrees are copied once for each parent.
+ * Return value: The copy, or NULL if it could not be allocated. */
+static node_t *clone_tree(node_t *nptr) {
+    node_t *copy = malloc(sizeof(node_t));
+    if (! copy) return NULL;
+    *copy = *nptr;
+    copy->refs = 0;
+    copy->flags = 0;
+    type_t type = nptr->type == ID_TYPE ? STRING_TYPE : nptr->type;
+    if (nptr->node_type != NT_LEAF) type = NO_TYPE;
+    memset(copy->children, 0, sizeof(copy->children));
+    if (! copy_value(&copy->val, &nptr->val, type)) {
+        free(copy);
+        return NULL;
+    }
+    for (int i = 0; i < 3; i++) {
+        if (nptr->children[i] && ! (copy->children[i] = clone_tree(nptr->children[i]))) {
+            cleanup(copy);
+            return NULL;
+        }
+    }
+    return copy;
+}
+
+static bool same_value(type_t type, const value_t *a, const value_t *b) {
+    switch (type) {
+        case INT_TYPE:
+            return a->ival == b->ival;
+        case BOOL_TYPE:
+            return a->bval == b->bval;
+        case STRING_TYPE:
+            return strcmp(STR_VAL(*a), STR_VAL(*b)) == 0;
+        case ARRAY_TYPE:
+            return a->aval->len == b->aval->len
+                   && memcmp(a->aval->elems, b->aval->elems, a->aval->len * sizeof(int)) == 0;
+        default:
+            return false;
+    }
+}
+
+/* parse_line() - parse a line that is new in this version of the script. */
+static void parse_line(line_t *line) {
+    line->parsed = true;
+    if (strlen(line->text) > MAX_LINE_CHARS - 1) {
+        sprintf(printbuf, "max input size is %d characters", MAX_LINE_CHARS - 2);
+        logging(LOG_ERROR, printbuf);
+        return;
+    }
+    set_input_line(line->text);
+    node_t *root = read_and_parse();
+    if (ignore_input || terminate) {
+        cleanup(root);
+        return;
+    }
+    line->tree = root;
+    int cap = 0;
+    node_t *expr = root->type == ID_TYPE ? root->children[1] : root;
+    if (! collect_reads(line, expr, &cap)) {
+        line->tree = NULL;
+        cleanup(root);
+        logging(LOG_FATAL, "failed to allocate script");
+    }
+}
+
+/* eval_line() - evaluate a copy of a line's tree, and mark the variable it
+ * assigns dirty unless it got the same value as in the last pass. */
+static void eval_line(line_t *line) {
+    // the table must hold what the line reads, and what it assigns in case
+    // the assignment fails
+    for (int i = 0; i < line->nreads && pending_count; i++) {
+        var_state_t *var = var_state(line->reads[i], false);
+        if (var && var->pending) store_pending(var);
+    }
+    const char *name = assigned_name(line);
+    var_state_t *state = name ? var_state(name, false) : NULL;
+    if (state && state->pending) store_pending(state);
+
+    node_t *root = clone_tree(line->tree);
+    if (! root) {
+        logging(LOG_FATAL, "failed to allocate node");
+        return;
+    }
+    infer_and_eval(root);
+    format_and_print(root);
+    cleanup(root);
+
+    if (! name) return;
+    type_t type = NO_TYPE;
+    value_t val = {0};
+    entry_t *var = ignore_input || terminate ? NULL : get((char *) name);
+    if (var && copy_value(&val, &var->val, var->type)) type = var->type;
+    state = var_state(name, true);
+    if (state && (type != NO_TYPE || line->type != NO_TYPE))
+        set_dirty(state, type != line->type || ! same_value(type, &val, &line->val));
+    free_value(&line->val, line->type);
+    line->type = type;
+    line->val = val;
+}
+
+/* Commands that only read the table; any other command can change it. */
+static bool read_only_command(const char *text) {
+    const char *c = text + strspn(text, " \t") + 1;
+    return *c == 'p' || *c == 's' || *c == 'q';
+}
+
+/* run_line() - run one line of the pass with its output captured, and print
+ * the output if it differs from the last time. */
+static void run_line(line_t *line, int lineno) {
+    char *buf = NULL;
+    size_t len = 0;
+    FILE *mem = open_memstream(&buf, &len);
+    if (! mem) {
+        logging(LOG_FATAL, "failed to capture output");
+        return;
+    }
+    FILE *out = outfile, *err = errfile;
+    outfile = errfile = mem;
+    if (line->command) {
+        store_all_pending();
+        set_input_line(line->text);
+        cleanup(read_and_parse());
+    } else {
+        if (! line->parsed) parse_line(line);
+        if (line->tree && ! terminate) eval_line(line);
+    }
+    fclose(mem);
+    outfile = out;
+    errfile = err;
+
+    if (len > 0 && (! line->output || len != line->output_len
+                    || memcmp(buf, line->output, len) != 0)) {
+        fprintf(outfile, "%d", lineno);
+        fwrite(buf, 1, len, outfile);
+    }
+    free(line->output);
+    line->output = buf;
+    line->output_len = len;
+}
+
+/* run_pass() - replay a version of the script. old and match describe the
+ * previous version as set up by diff_script(), or are NULL on the first
+ * pass. */
+static void run_pass(script_t *old, script_t *cur, const int *match) {
+    delete_table();
+    init_table();
+    clear_vars();
+    bool all_dirty = false;
+    int evaluated = 0, next_old = 0, i;
+    for (i = 0; i < cur->n && ! terminate; i++) {
+        line_t *line = &cur->lines[i];
+        if (match && match[i] >= 0) {
+            // lines deleted just before this one leave what they assigned dirty
+            for (; next_old < match[i]; next_old++) {
+                const char *name = assigned_name(&old->lines[next_old]);
+                var_state_t *var = name ? var_state(name, true) : NULL;
+                if (var) set_dirty(var, true);
+            }
+            next_old = match[i] + 1;
+        }
+        ignore_input = false;
+        input_lineno = i + 1;
+
+        if (! line->command && line->parsed
+            && (! line->tree || ! (line->stale || all_dirty || reads_dirty(line)))) {
+            // the line would do what it did last time
+            const char *name = assigned_name(line);
+            var_state_t *var = name && line->type != NO_TYPE ? var_state(name, true) : NULL;
+            if (var) {
+                if (! var->pending) pending_count++;
+                var->pending = line;
+                set_dirty(var, false);
+            }
+            continue;
+        }
+        run_line(line, i + 1);
+        line->stale = false;
+        if (line->command && ! read_only_command(line->text)) all_dirty = true;
+        evaluated++;
+    }
+    // lines after @q did not run, so nothing is known about them
+    for (; i < cur->n; i++) cur->lines[i].stale = true;
+    terminate = ignore_input = false;
+    fflush(outfile);
+
+    sprintf(printbuf, "%d of %d lines run", evaluated, cur->n);
+    logging(LOG_INFO, printbuf);
+}
+
+static void on_signal(int sig) {
+    interrupted = 1;
+}
+
+/* wait_for_change() - block until the script is written or replaced.
+ * Return value: false when interrupted. */
+static bool wait_for_change(int fd, const char *base) {
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (! interrupted) {
+        ssize_t len = read(fd, events, sizeof(events));
+        if (len < 0 && errno == EINTR) continue;
+        if (len <= 0) return false;
+        bool changed = false;
+        for (char *p = events; p < events + len; ) {
+            struct inotify_event *ev = (struct inotify_event *) p;
+            if (ev->len && strcmp(ev->name, base) == 0) changed = true;
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+        if (changed) return true;
+    }
+    return false;
+}
+
+int run_watch(void) {
+    script_t cur = {0}, next;
+    if (! load_script(watch_file, &cur)) {
+        sprintf(printbuf, "script %.60s not found", watch_file);
+        logging(LOG_FATAL, printbuf);
+        return EXIT_FAILURE;
+    }
+
+    // the directory is watched, so editors that replace the file are seen
+    char *dir = strdup(watch_file);
+    char *slash = dir ? strrchr(dir, '/') : NULL;
+    const char *base = slash ? slash + 1 : watch_file;
+    if (slash) *slash = '\0';
+    int fd = inotify_init1(IN_CLOEXEC);
+    if (! dir || fd < 0
+        || inotify_add_watch(fd, slash ? (*dir ? dir : "/") : ".", IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        sprintf(printbuf, "failed to watch %.60s", watch_file);
+        logging(LOG_FATAL, printbuf);
+        if (fd >= 0) close(fd);
+        free(dir);
+        free_script(&cur);
+        return EXIT_FAILURE;
+    }
+    struct sigaction sa = {0};
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    ci_prompt = "";
+    run_pass(NULL, &cur, NULL);
+    while (wait_for_change(fd, base)) {
+        if (! load_script(watch_file, &next)) {
+            sprintf(printbuf, "failed to read %.60s", watch_file);
+            logging(LOG_INFO, printbuf);
+            continue;
+        }
+        int *match = malloc((next.n ? next.n : 1) * sizeof(int));
+        if (! match) {
+            free_script(&next);
+            logging(LOG_FATAL, "failed to allocate script");
+            break;
+        }
+        diff_script(&cur, &next, match);
+        run_pass(&cur, &next, match);
+        free(match);
+        free_script(&cur);
+        cur = next;
+    }
+
+    close(fd);
+    free(dir);
+    free_script(&cur);
+    free(vars);
+    delete_table();
+    flush_error_log();
+    return EXIT_SUCCESS;
+}